@@ -0,0 +1,769 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cwchar>
+#include <thread>
+
+#include <GL/glew.h>
+
+#include "headless.h"
+#include "../src/FontAtlas.h"
+#include "../src/Text2D.h"
+#include "../src/TextBlob.h"
+#include "../src/Bidi.h"
+#include "../src/SoftwareBackend.h"
+#include "../src/GLLabels.h"
+#include "../src/common.h"
+#include "../example/graphics.h"
+
+
+/*
+ * Benchmarks of the atlas and Text2D, runs without a window (see headless.h) and writes the
+ * results as JSON. Built with PTT_PROFILE to split the rebuilds in layout and upload time.
+ */
+
+
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 720
+#define BENCH_MIN_MS 250.0 // minimum time spent on each measurement
+#define BENCH_STRING_LEN 128 // glyphs per string in the frame cases
+
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct bench_result{
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+static std::vector<struct bench_result> results;
+
+
+void usage(){
+    std::cerr << "Usage: ptt-bench [-f FONT] [-o OUTPUT] [-q]\n\n"
+              << "  -f FONT    font file (default data/Vera.ttf)\n"
+              << "  -o OUTPUT  JSON results (default bench_results.json)\n"
+              << "  -q         quick run, skips the 1M glyph case" << std::endl;
+}
+
+
+static void report(const std::string& name, double value, const char* unit){
+    struct bench_result result = {name, value, unit};
+    results.push_back(result);
+    std::cout << name << ": " << value << " " << unit << std::endl;
+}
+
+
+static double ms_since(const bench_clock::time_point& start){
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+
+// median time of fn in ms, runs it at least min_reps times and for at least BENCH_MIN_MS
+template<typename F>
+static double median_ms(F fn, uint min_reps){
+    std::vector<double> times;
+    bench_clock::time_point start = bench_clock::now(), rep_start;
+
+    while(times.size() < min_reps || ms_since(start) < BENCH_MIN_MS){
+        rep_start = bench_clock::now();
+        fn();
+        times.push_back(ms_since(rep_start));
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+
+static void fill_string(wchar_t* buffer, uint len, uint seed){
+    const wchar_t pattern[] = L"The quick brown fox jumps over the lazy dog 0123456789 "
+                              L"\x3b1\x3b2\x3b3\x3b4 AVATAR ";
+    const uint pattern_len = sizeof(pattern) / sizeof(wchar_t) - 1;
+
+    for(uint i=0; i < len; i++)
+        buffer[i] = pattern[(i + seed * 7) % pattern_len];
+    buffer[len] = L'\0';
+}
+
+
+// latin with hebrew, arabic, numbers and brackets, every line gets reordered
+static void fill_mixed_string(wchar_t* buffer, uint len, uint seed){
+    const wchar_t pattern[] = L"The \x5e9\x5dc\x5d5\x5dd (world) 2024 \x627\x644\x639\x627\x644\x645 "
+                              L"fox 3.14 \x5d0\x5d1\x5d2 [\x5d3\x5d4] ";
+    const uint pattern_len = sizeof(pattern) / sizeof(wchar_t) - 1;
+
+    for(uint i=0; i < len; i++)
+        buffer[i] = pattern[(i + seed * 7) % pattern_len];
+    buffer[len] = L'\0';
+}
+
+
+static void bench_bake(const char* font){
+    FontAtlas atlas(1024);
+    double ms;
+
+    if(atlas.loadFont(font, 32))
+        return;
+    atlas.loadCharacterRange(32, 255);
+    atlas.loadCharacterRange(913, 1023);
+    atlas.loadCharacterRange(1024, 1279);
+    ms = median_ms([&atlas](){ atlas.createAtlas(false); }, 3);
+
+    report("bake_ms", ms, "ms");
+    report("bake_per_glyph", ms * 1000.0 / atlas.getCharacterCount(), "us/glyph");
+}
+
+
+// regular, bold, oblique and bold oblique in one atlas, before they were four atlases
+static void bench_styles(const char* font){
+    FontAtlas atlas(1024);
+    struct font_style style = {};
+    uint base;
+    double ms;
+
+    if(atlas.loadFont(font, 32))
+        return;
+    atlas.loadCharacterRange(32, 255);
+    base = atlas.getCharacterCount();
+    style.embolden = 1.0f;
+    atlas.addStyle(style);
+    style.oblique = 0.2f;
+    atlas.addStyle(style); // shares the bold glyphs
+    style.embolden = 0.0f;
+    atlas.addStyle(style); // no glyphs, sheared quads
+    ms = median_ms([&atlas](){ atlas.createAtlas(false); }, 3);
+
+    report("styles_bake_ms", ms, "ms");
+    report("styles_glyphs", atlas.getCharacterCount(), "glyphs");
+    report("styles_separate_glyphs", base * 4, "glyphs");
+}
+
+
+static void bench_lookup(const FontAtlas& atlas){
+    std::vector<uint> codes;
+    const character* ch;
+    uint checksum = 0;
+    double ms;
+
+    // printable ascii, some greek and a few missing characters
+    for(uint i=0; i < 4096; i++)
+        codes.push_back(i % 10 == 9 ? 0x4e00 + i : (i % 3 ? 32 + i % 95 : 913 + i % 57));
+    ms = median_ms([&](){
+        for(uint i=0; i < codes.size() * 64; i++)
+            checksum += atlas.getCharacter(codes[i % codes.size()], &ch) + ch->advance_x;
+    }, 5);
+
+    report("getCharacter", codes.size() * 64 / (ms * 1000.0), "Mlookups/s");
+    if(!checksum) // keeps the loop alive
+        std::cerr << "bench_lookup: empty checksum" << std::endl;
+}
+
+
+static void bench_add_string(const FontAtlas& atlas, GLuint shader){
+    const uint num_strings = 10000, len = 64;
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    double ms;
+
+    ms = median_ms([&](){
+        Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        for(uint i=0; i < num_strings; i++){
+            fill_string(buffer, len, i);
+            text.addString(buffer, 0, i % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                           STRING_ALIGN_RIGHT, color);
+        }
+    }, 3);
+
+    report("addString", num_strings / (ms / 1000.0), "strings/s");
+    report("addString_glyphs", num_strings * len / (ms / 1000.0), "glyphs/s");
+}
+
+
+static void bench_frames(const FontAtlas& atlas, GLuint shader, uint glyphs){
+    std::string prefix = "frame_" + std::to_string(glyphs) + "_";
+    uint num_strings = (glyphs + BENCH_STRING_LEN - 1) / BENCH_STRING_LEN, seed = 0;
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    struct text_stats stats;
+    double ms;
+
+    Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+    for(uint i=0; i < num_strings; i++){
+        fill_string(buffer, BENCH_STRING_LEN, i);
+        text.addString(buffer, 0, (i * 16) % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                       STRING_ALIGN_RIGHT, color);
+    }
+
+    // first frame builds the buffers
+    bench_clock::time_point start = bench_clock::now();
+    text.render();
+    glFinish();
+    report(prefix + "first_ms", ms_since(start), "ms");
+    text.getStats(stats);
+    if(stats.rebuilds){ // PTT_PROFILE
+        report(prefix + "layout_ms", stats.layout_ms, "ms");
+        report(prefix + "upload_ms", stats.upload_ms, "ms");
+        report(prefix + "upload_bytes", stats.bytes_uploaded, "bytes/frame");
+        report(prefix + "updateBuffers", num_strings * BENCH_STRING_LEN / ((stats.layout_ms + stats.upload_ms) / 1000.0),
+               "glyphs/s");
+    }
+
+    ms = median_ms([&text](){
+        text.render();
+        glFinish();
+    }, 10);
+    report(prefix + "static_ms", ms, "ms");
+
+    // one changed string rebuilds all the buffers
+    ms = median_ms([&](){
+        fill_string(buffer, BENCH_STRING_LEN, ++seed);
+        text.updateString(0, buffer, 0, 0);
+        text.render();
+        glFinish();
+    }, 3);
+    report(prefix + "rebuild_ms", ms, "ms");
+}
+
+
+// render thread time to get new strings on screen, laid out by itself or by other threads
+static void bench_batches(const FontAtlas& atlas, GLuint shader){
+    const uint num_strings = 2000;
+    const uint num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    std::vector<double> workers_ms, render_ms;
+    double ms;
+
+    ms = median_ms([&](){
+        Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        wchar_t buffer[STRING_MAX_LEN];
+        for(uint i=0; i < num_strings; i++){
+            fill_string(buffer, BENCH_STRING_LEN, i);
+            text.addString(buffer, 0, i % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                           STRING_ALIGN_RIGHT, color);
+        }
+        text.render(); // no glFinish, only the CPU side matters here
+    }, 3);
+    report("batch_render_thread_only_ms", ms, "ms");
+
+    // median_ms would time the workers too
+    for(uint rep=0; rep < 5; rep++){
+        Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        std::vector<std::thread> threads;
+
+        bench_clock::time_point start = bench_clock::now();
+        for(uint t=0; t < num_threads; t++){
+            threads.push_back(std::thread([&text, &color, t, num_threads](){
+                TextBatch batch(&text);
+                wchar_t buffer[STRING_MAX_LEN];
+                for(uint i=t; i < num_strings; i += num_threads){
+                    fill_string(buffer, BENCH_STRING_LEN, i);
+                    batch.addString(buffer, 0u, i % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                                    STRING_ALIGN_RIGHT, color);
+                }
+                text.submit(batch);
+            }));
+        }
+        for(uint t=0; t < num_threads; t++)
+            threads[t].join();
+        workers_ms.push_back(ms_since(start));
+
+        start = bench_clock::now();
+        text.render(); // no glFinish, only the CPU side matters here
+        render_ms.push_back(ms_since(start));
+    }
+    std::sort(workers_ms.begin(), workers_ms.end());
+    std::sort(render_ms.begin(), render_ms.end());
+    report("batch_workers_ms", workers_ms[2], "ms");
+    report("batch_render_thread_ms", render_ms[2], "ms");
+}
+
+
+// labels redrawn every frame with drawText, a few of them change, against the same retained
+static void bench_immediate(const FontAtlas& atlas, GLuint shader){
+    const uint num_labels = 1000, changing = 10;
+    struct text_style style = {0.5f, STRING_ALIGN_RIGHT, {1.f, 1.f, 1.f, 1.f}, 0};
+    wchar_t buffer[STRING_MAX_LEN];
+    uint frame = 0;
+    double ms;
+
+    Text2D retained(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+    for(uint i=0; i < num_labels; i++){
+        fill_string(buffer, 24, i);
+        retained.addString(buffer, (i / 45) * 64, (i % 45) * 16, 0.5f, STRING_DRAW_ABSOLUTE_BL,
+                           STRING_ALIGN_RIGHT, style.color);
+    }
+    ms = median_ms([&retained](){
+        retained.render();
+        glFinish();
+    }, 10);
+    report("labels_retained_ms", ms, "ms");
+
+    Text2D immediate(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+    ms = median_ms([&](){
+        frame++;
+        for(uint i=0; i < num_labels; i++){
+            fill_string(buffer, 24, i < changing ? i + frame : i);
+            immediate.drawText((i / 45) * 64, (i % 45) * 16, buffer, style);
+        }
+        immediate.render();
+        glFinish();
+    }, 10);
+    report("labels_immediate_ms", ms, "ms");
+}
+
+
+// first frame of a static screen, from its strings or from a blob file built in a former run
+static void bench_blob(const FontAtlas& atlas, GLuint shader, const std::string& path){
+    const uint num_strings = 2000, len = 64;
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    std::vector<double> strings_ms, blob_ms;
+
+    {
+        Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        TextBlob blob;
+        for(uint i=0; i < num_strings; i++){
+            fill_string(buffer, len, i);
+            text.addString(buffer, 0, i % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                           STRING_ALIGN_RIGHT, color);
+        }
+        blob.build(text);
+        if(blob.save(path.c_str()))
+            return;
+    }
+
+    // the draw is the same for both, only the time until the upload is counted
+    for(uint rep=0; rep < 5; rep++){
+        Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        Text2D static_text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        struct text_stats stats;
+        TextBlob blob;
+        double ms;
+
+        bench_clock::time_point start = bench_clock::now();
+        for(uint i=0; i < num_strings; i++){
+            fill_string(buffer, len, i);
+            text.addString(buffer, 0, i % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                           STRING_ALIGN_RIGHT, color);
+        }
+        ms = ms_since(start);
+        text.render();
+        glFinish();
+        text.getStats(stats);
+        strings_ms.push_back(ms + stats.layout_ms + stats.upload_ms);
+
+        start = bench_clock::now();
+        blob.load(path.c_str());
+        static_text.setBlob(&blob);
+        ms = ms_since(start);
+        static_text.render();
+        glFinish();
+        static_text.getStats(stats);
+        blob_ms.push_back(ms + stats.layout_ms + stats.upload_ms);
+    }
+    std::sort(strings_ms.begin(), strings_ms.end());
+    std::sort(blob_ms.begin(), blob_ms.end());
+    report("static_screen_strings_ms", strings_ms[2], "ms");
+    report("static_screen_blob_ms", blob_ms[2], "ms");
+    std::remove(path.c_str());
+}
+
+
+// first frame of a table whose cells repeat a few values, against one whose cells are all different
+static void bench_table(const FontAtlas& atlas, GLuint shader){
+    const uint num_cells = 20000, len = 8, columns = 40;
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+
+    for(uint repetitive=0; repetitive < 2; repetitive++){
+        std::string prefix = repetitive ? "table_repetitive_" : "table_unique_";
+        std::vector<double> add_ms, layout_ms;
+
+        for(uint rep=0; rep < 5; rep++){
+            Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+            struct text_stats stats;
+
+            bench_clock::time_point start = bench_clock::now();
+            for(uint i=0; i < num_cells; i++){
+                if(repetitive)
+                    fill_string(buffer, len, i % 50);
+                else
+                    swprintf(buffer, STRING_MAX_LEN, L"%08u", i);
+                text.addString(buffer, (i % columns) * 32, (i / columns) % BENCH_HEIGHT, 0.5f,
+                               STRING_DRAW_ABSOLUTE_TL, STRING_ALIGN_RIGHT, color);
+            }
+            add_ms.push_back(ms_since(start));
+            text.render(); // no glFinish, only the CPU side matters here
+            text.getStats(stats);
+            layout_ms.push_back(stats.layout_ms);
+        }
+        std::sort(add_ms.begin(), add_ms.end());
+        std::sort(layout_ms.begin(), layout_ms.end());
+        report(prefix + "add_ms", add_ms[2], "ms");
+        report(prefix + "layout_ms", layout_ms[2], "ms"); // PTT_PROFILE
+    }
+}
+
+
+#ifdef PTT_ALLOC_COUNTER
+/* heap allocations of the frames of a dashboard once it's warm, half of its 2000 strings are
+ * counters that change every frame and the others cycle through a few shared labels. The
+ * counters keep their width, a text longer than it has ever been needs more memory. */
+static void bench_steady(const FontAtlas& atlas, GLuint shader){
+    const uint num_strings = 2000, warm_frames = 10, frames = 50;
+    static const wchar_t* labels[] = {L"OK", L"WARN", L"FAIL", L"N/A", L"idle", L"busy"};
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    unsigned long most = 0;
+    std::vector<double> rebuild_ms;
+
+    Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+    text.setCulling(true);
+    text.reserve(num_strings, num_strings * 8);
+    for(uint frame=0; frame < warm_frames + frames; frame++){
+        unsigned long allocations = alloc_count();
+        struct text_stats stats;
+
+        for(uint i=0; i < num_strings; i++){
+            uint x = (i % 20) * 50 + frame % 2, y = (i / 20) * 8 % BENCH_HEIGHT;
+            if(i % 2)
+                swprintf(buffer, STRING_MAX_LEN, L"%05u", (i * 7919 + frame * 31) % 100000);
+            else
+                wstrcpy(buffer, labels[(i + frame / 5) % 6], STRING_MAX_LEN);
+            if(frame)
+                text.updateString(i, buffer, x, y);
+            else
+                text.addString(buffer, x, y, 0.5f, STRING_DRAW_ABSOLUTE_TL, STRING_ALIGN_RIGHT,
+                               color);
+        }
+        text.render();
+        text.getStats(stats);
+        if(frame >= warm_frames){
+            most = std::max(most, alloc_count() - allocations);
+            rebuild_ms.push_back(stats.layout_ms + stats.upload_ms);
+        }
+    }
+    std::sort(rebuild_ms.begin(), rebuild_ms.end());
+    report("steady_frame_allocations", most, "allocations"); // worst frame
+    report("steady_rebuild_ms", rebuild_ms[frames / 2], "ms");
+}
+#endif // PTT_ALLOC_COUNTER
+
+
+/* render thread time of a font size change with 2000 strings on screen, baking the new size in
+ * place against baking it with rebake while frames are drawn. The draws aren't counted, only
+ * the baking, swapping and the rebuild of the buffers (PTT_PROFILE). */
+static void bench_rebake(const char* font, GLuint shader){
+    const uint num_strings = 2000;
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    std::vector<double> in_place_ms, poll_ms, swap_ms;
+
+    for(uint rep=0; rep < 5; rep++){
+        FontAtlas atlas(1024);
+        struct text_stats stats;
+        double ms, worst_poll = 0.0;
+        bool swapped = false;
+
+        if(atlas.loadFont(font, 24))
+            return;
+        atlas.loadCharacterRange(32, 255);
+        atlas.createAtlas(false);
+        Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        for(uint i=0; i < num_strings; i++){
+            fill_string(buffer, 64, i * 50 + rep);
+            text.addString(buffer, 0, i % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                           STRING_ALIGN_RIGHT, color);
+        }
+        text.render();
+
+        bench_clock::time_point start = bench_clock::now();
+        atlas.loadFont(font, 32);
+        atlas.loadCharacterRange(32, 255);
+        atlas.createAtlas(false);
+        ms = ms_since(start);
+        text.render();
+        text.getStats(stats);
+        in_place_ms.push_back(ms + stats.layout_ms + stats.upload_ms);
+
+        atlas.rebake(nullptr, 24);
+        while(!swapped){
+            start = bench_clock::now();
+            swapped = atlas.swapRebaked();
+            ms = ms_since(start);
+            if(!swapped){
+                worst_poll = std::max(worst_poll, ms);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1)); // a frame
+            }
+        }
+        text.render();
+        glFinish();
+        text.getStats(stats);
+        swap_ms.push_back(ms + stats.layout_ms + stats.upload_ms);
+        poll_ms.push_back(worst_poll);
+    }
+    std::sort(in_place_ms.begin(), in_place_ms.end());
+    std::sort(poll_ms.begin(), poll_ms.end());
+    std::sort(swap_ms.begin(), swap_ms.end());
+    report("resize_in_place_ms", in_place_ms[2], "ms");
+    report("rebake_poll_ms", poll_ms[2], "ms"); // worst frame while baking
+    report("rebake_swap_ms", swap_ms[2], "ms");
+}
+
+
+// reordering of mixed direction text, and rebuilds with the order cached against left to right text
+static void bench_bidi(const FontAtlas& atlas, GLuint shader){
+    const uint num_strings = 500;
+    const double glyphs = num_strings * BENCH_STRING_LEN;
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    std::vector<uint16_t> order;
+    double ms;
+
+    fill_mixed_string(buffer, BENCH_STRING_LEN, 0);
+    ms = median_ms([&](){
+        for(uint i=0; i < num_strings; i++)
+            bidi_reorder(buffer, order);
+    }, 3);
+    report("bidi_reorder", ms * 1e6 / glyphs, "ns/glyph");
+
+    for(uint mixed=0; mixed < 2; mixed++){
+        std::string prefix = mixed ? "bidi_mixed_" : "bidi_ltr_";
+        std::vector<double> layout_ms;
+        struct text_stats stats;
+        uint seed = 0;
+
+        Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+        for(uint i=0; i < num_strings; i++){
+            (mixed ? fill_mixed_string : fill_string)(buffer, BENCH_STRING_LEN, i);
+            text.addString(buffer, 0, (i * 16) % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                           STRING_ALIGN_RIGHT, color);
+        }
+        text.render();
+        glFinish();
+        text.getStats(stats);
+        if(!stats.rebuilds) // PTT_PROFILE
+            return;
+        report(prefix + "layout", stats.layout_ms * 1e6 / glyphs, "ns/glyph");
+
+        // the other strings keep their order and layout
+        median_ms([&](){
+            (mixed ? fill_mixed_string : fill_string)(buffer, BENCH_STRING_LEN, ++seed);
+            text.updateString(0, buffer, 0, 0);
+            text.render();
+            text.getStats(stats);
+            layout_ms.push_back(stats.layout_ms);
+        }, 10);
+        std::sort(layout_ms.begin(), layout_ms.end());
+        report(prefix + "cached_layout", layout_ms[layout_ms.size() / 2] * 1e6 / glyphs, "ns/glyph");
+    }
+}
+
+
+/* labels that move every frame, laid out by Text2D (every string updated) against GLLabels
+ * (the positions uploaded, the quads written by a compute shader). The draws are scissored to a
+ * pixel so the fill doesn't hide the layout, the frames end with a glFinish. */
+static void bench_labels(const FontAtlas& atlas, GLuint shader, uint num_labels){
+    std::string prefix = "gpu_labels_" + std::to_string(num_labels) + "_";
+    float color[4] = {1.f, 1.f, 1.f, 1.f};
+    std::vector<std::wstring> texts(num_labels);
+    std::vector<float> positions(num_labels * 2);
+    wchar_t buffer[STRING_MAX_LEN];
+    uint frame = 0;
+    double ms;
+
+    GLLabels labels(&atlas, shader);
+    if(!labels.isSupported())
+        return;
+    Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, shader);
+    for(uint i=0; i < num_labels; i++){
+        swprintf(buffer, STRING_MAX_LEN, L"P%u", i);
+        texts[i] = buffer;
+        positions[i * 2] = (i * 37) % BENCH_WIDTH;
+        positions[i * 2 + 1] = (i * 53) % BENCH_HEIGHT;
+        text.addString(buffer, positions[i * 2], positions[i * 2 + 1], 0.25f,
+                       STRING_DRAW_ABSOLUTE_BL, STRING_ALIGN_CENTER_XY, color);
+        labels.addLabel(buffer, positions[i * 2], positions[i * 2 + 1], 0.25f,
+                        STRING_ALIGN_CENTER_XY, color);
+    }
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, 0, 1, 1);
+
+    bench_clock::time_point start = bench_clock::now();
+    text.render();
+    glFinish();
+    report(prefix + "cpu_first_ms", ms_since(start), "ms");
+    start = bench_clock::now();
+    labels.render();
+    glFinish();
+    report(prefix + "gpu_first_ms", ms_since(start), "ms");
+
+    ms = median_ms([&](){
+        frame++;
+        for(uint i=0; i < num_labels; i++)
+            text.updateString(i, texts[i].c_str(), (i * 37 + frame) % BENCH_WIDTH,
+                              (i * 53 + frame) % BENCH_HEIGHT);
+        text.render();
+        glFinish();
+    }, 5);
+    report(prefix + "cpu_move_ms", ms, "ms");
+    report(prefix + "cpu_move", labels.getGlyphCount() / (ms / 1000.0), "glyphs/s");
+
+    ms = median_ms([&](){
+        frame++;
+        for(uint i=0; i < num_labels; i++){
+            positions[i * 2] = (i * 37 + frame) % BENCH_WIDTH;
+            positions[i * 2 + 1] = (i * 53 + frame) % BENCH_HEIGHT;
+        }
+        labels.setPositions(0, num_labels, positions.data());
+        labels.render();
+        glFinish();
+    }, 5);
+    report(prefix + "gpu_move_ms", ms, "ms");
+    report(prefix + "gpu_move", labels.getGlyphCount() / (ms / 1000.0), "glyphs/s");
+    glDisable(GL_SCISSOR_TEST);
+}
+
+
+// CPU rasterizer, the geometry is already built so this is the blending alone
+static void bench_software(const FontAtlas& atlas, uint glyphs){
+    std::string prefix = "software_" + std::to_string(glyphs) + "_";
+    uint num_strings = (glyphs + BENCH_STRING_LEN - 1) / BENCH_STRING_LEN;
+    float color[4] = {1.f, 1.f, 1.f, 1.f}, background[4] = {0.f, 0.f, 0.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    size_t pixels = 0;
+    double ms;
+
+    SoftwareBackend backend(BENCH_WIDTH, BENCH_HEIGHT, 0);
+    Text2D text(BENCH_WIDTH, BENCH_HEIGHT, &atlas, &backend);
+    for(uint i=0; i < num_strings; i++){
+        fill_string(buffer, BENCH_STRING_LEN, i);
+        text.addString(buffer, 0, (i * 16) % BENCH_HEIGHT, 0.5f, STRING_DRAW_ABSOLUTE_TL,
+                       STRING_ALIGN_RIGHT, color);
+    }
+    text.render(); // builds the geometry
+
+    ms = median_ms([&](){
+        backend.clear(background);
+        text.render();
+        pixels = backend.getPixelsDrawn();
+    }, 5);
+    report(prefix + "frame_ms", ms, "ms");
+    report(prefix + "fill_rate", pixels / (ms * 1000.0), "MPix/s");
+    report(prefix + "glyph_rate", num_strings * BENCH_STRING_LEN / (ms / 1000.0), "glyphs/s");
+}
+
+
+static bool write_results(const char* path, const char* renderer){
+    std::ofstream file(path);
+
+    if(!file.is_open()){
+        std::cerr << "Can't write " << path << std::endl;
+        return false;
+    }
+    file << "{\n  \"renderer\": \"" << renderer << "\",\n";
+#ifdef DEBUG
+    file << "  \"build\": \"debug\",\n";
+#else
+    file << "  \"build\": \"release\",\n";
+#endif // DEBUG
+    file << "  \"results\": [\n";
+    for(uint i=0; i < results.size(); i++){
+        file << "    {\"name\": \"" << results[i].name << "\", \"value\": " << results[i].value
+             << ", \"unit\": \"" << results[i].unit << "\"}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n}" << std::endl;
+    return true;
+}
+
+
+int main(int argc, char* argv[]){
+    const char* font = "data/Vera.ttf", *output = "bench_results.json";
+    std::string renderer;
+    bool quick = false;
+    GLuint shader;
+
+    for(int i=1; i < argc; i++){
+        if(!std::strcmp(argv[i], "-f") && i + 1 < argc)
+            font = argv[++i];
+        else if(!std::strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if(!std::strcmp(argv[i], "-q"))
+            quick = true;
+        else{
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(create_headless_context(BENCH_WIDTH, BENCH_HEIGHT) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    renderer = (const char*)glGetString(GL_RENDERER);
+    std::cout << "Renderer: " << renderer << std::endl;
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    if(get_program(shader) == EXIT_FAILURE){
+        std::cerr << "Failed to create text shaders" << std::endl;
+        return EXIT_FAILURE;
+    }
+    update_ortho_proj(BENCH_WIDTH, 0.0f, BENCH_HEIGHT, 0.0f, 1.0f, -1.0f, shader);
+
+    bench_bake(font);
+    bench_styles(font);
+
+    FontAtlas atlas(512);
+    if(atlas.loadFont(font, 32))
+        return EXIT_FAILURE;
+    atlas.loadCharacterRange(32, 255);
+    atlas.loadCharacterRange(913, 1023);
+    atlas.createAtlas(false);
+
+    bench_lookup(atlas);
+    bench_add_string(atlas, shader);
+    bench_immediate(atlas, shader);
+    bench_batches(atlas, shader);
+    bench_blob(atlas, shader, std::string(output) + ".blob");
+    bench_table(atlas, shader);
+#ifdef PTT_ALLOC_COUNTER
+    bench_steady(atlas, shader);
+#endif // PTT_ALLOC_COUNTER
+    bench_rebake(font, shader);
+    bench_bidi(atlas, shader);
+    for(uint glyphs = 1000; glyphs <= (quick ? 100000u : 1000000u); glyphs *= 10)
+        bench_frames(atlas, shader, glyphs);
+    for(uint glyphs = 10000; glyphs <= 100000; glyphs *= 10)
+        bench_software(atlas, glyphs);
+    for(uint labels = 10000; labels <= (quick ? 100000u : 1000000u); labels *= 10)
+        bench_labels(atlas, shader, labels);
+
+    glDeleteProgram(shader);
+    destroy_headless_context();
+    return write_results(output, renderer.c_str()) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
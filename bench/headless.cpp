@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <iostream>
+#include <cstdlib>
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "headless.h"
+
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static GLuint fbo = 0, color_rb = 0;
+
+
+int create_headless_context(int width, int height){
+    EGLint major, minor, num_configs;
+    EGLConfig config;
+    const EGLint config_attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE,
+                                     EGL_OPENGL_BIT, EGL_NONE};
+    const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 4,
+                                      EGL_CONTEXT_MINOR_VERSION, 1,
+                                      EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                      EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = 
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if(get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if(display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(!eglInitialize(display, &major, &minor)){
+        std::cerr << "create_headless_context: eglInitialize failed (0x" << std::hex 
+                  << eglGetError() << std::dec << ")" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if(!eglChooseConfig(display, config_attribs, &config, 1, &num_configs))
+        num_configs = 0;
+    eglBindAPI(EGL_OPENGL_API);
+    // surfaceless contexts don't need a config (EGL_KHR_no_config_context)
+    context = eglCreateContext(display, num_configs ? config : (EGLConfig)0, EGL_NO_CONTEXT,
+                               context_attribs);
+    if(context == EGL_NO_CONTEXT ||
+       !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)){
+        std::cerr << "create_headless_context: can't create a 4.1 core context (0x" << std::hex
+                  << eglGetError() << std::dec << ")" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // glewInit expects a GLX display, glewContextInit only loads the GL entry points
+    glewExperimental = GL_TRUE;
+    if(glewContextInit() != GLEW_OK){
+        std::cerr << "create_headless_context: failed to initialize GLEW" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(1, &color_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, color_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rb);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        std::cerr << "create_headless_context: incomplete framebuffer" << std::endl;
+        return EXIT_FAILURE;
+    }
+    glViewport(0, 0, width, height);
+
+    return EXIT_SUCCESS;
+}
+
+
+void destroy_headless_context(){
+    if(fbo){
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &color_rb);
+        fbo = 0;
+    }
+    if(display != EGL_NO_DISPLAY){
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+    }
+}
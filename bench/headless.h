@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <GL/glew.h>
+
+
+/* Creates an OpenGL 4.1 core context without a window or a display server (EGL with Mesa's
+ * surfaceless platform, works with llvmpipe) and an offscreen framebuffer of the given size,
+ * which is left bound. GLEW is initialized too. */
+int create_headless_context(int width, int height);
+void destroy_headless_context();
+
+#endif
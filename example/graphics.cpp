@@ -36,6 +36,119 @@ const GLchar frag_shader[] = "#version 410\n"
                              "}\n";
 
 
+// for atlases with LCD rendering, needs glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC1_COLOR)
+const GLchar lcd_frag_shader[] = "#version 410\n"
+                                 "in vec2 st;\n"
+                                 "in vec4 color;\n"
+                                 "layout(location = 0, index = 0) out vec4 frag_colour;\n"
+                                 "layout(location = 0, index = 1) out vec4 blend_weights;\n"
+
+                                 "uniform sampler2D texture_sampler;\n"
+
+                                 "void main(){\n"
+                                     "float dx = 1.0 / float(textureSize(texture_sampler, 0).x);\n"
+                                     "vec3 coverage = vec3(texture(texture_sampler, st - vec2(dx, 0.0)).r,\n"
+                                     "                     texture(texture_sampler, st).r,\n"
+                                     "                     texture(texture_sampler, st + vec2(dx, 0.0)).r);\n"
+                                     "blend_weights = vec4(coverage * color.a, color.a);\n"
+                                     "frag_colour = vec4(color.rgb * blend_weights.rgb, color.a);\n"
+                                 "}\n";
+
+
+/* Atlas glyphs and outline glyphs (see FontAtlas::loadOutlines). The coverage of an outline
+ * glyph comes from the signed crossings of two rays, to +x and to +y, with its curves, each
+ * one weighted by its distance to the pixel center for the antialiasing. */
+const GLchar outline_frag_shader[] = "#version 410\n"
+                                     "in vec2 st;\n"
+                                     "in vec4 color;\n"
+                                     "out vec4 frag_colour;\n"
+
+                                     "uniform sampler2D texture_sampler;\n"
+                                     "uniform samplerBuffer curve_sampler;\n"
+
+                                     // crossing of the ray from the origin to +a, a0 and a2 on
+                                     // opposite sides (the curves are monotonic)
+                                     "float crossing(vec3 a, vec3 b, float pixel){\n"
+                                         "if((a.x <= 0.0) == (a.z <= 0.0))\n"
+                                             "return 0.0;\n"
+                                         "float qa = a.x - 2.0 * a.y + a.z, qb = a.y - a.x, t;\n"
+                                         "if(abs(qa) < 1e-6)\n"
+                                             "t = a.x / (a.x - a.z);\n"
+                                         "else{\n"
+                                             "float d = sqrt(max(qb * qb - qa * a.x, 0.0));\n"
+                                             "float t1 = (-qb - d) / qa, t2 = (-qb + d) / qa;\n"
+                                             "t = abs(t1 - 0.5) < abs(t2 - 0.5) ? t1 : t2;\n"
+                                         "}\n"
+                                         "t = clamp(t, 0.0, 1.0);\n"
+                                         "float x = mix(mix(b.x, b.y, t), mix(b.y, b.z, t), t);\n"
+                                         "return sign(a.z - a.x) * clamp(x / pixel + 0.5, 0.0, 1.0);\n"
+                                     "}\n"
+
+                                     "void main(){\n"
+                                         "vec2 pixel = fwidth(st);\n"
+                                         "if(st.x < 4.0){\n" // OUTLINE_CELL
+                                             "frag_colour = vec4(color.rgb, texture(texture_sampler, st).r * color.a);\n"
+                                             "return;\n"
+                                         "}\n"
+                                         "vec2 cell = floor(st / 4.0);\n"
+                                         "vec2 p = st - cell * 4.0 - 1.5;\n"
+                                         "vec4 header = texelFetch(curve_sampler, int(cell.x) - 1 + int(cell.y) * 255) * 65535.0;\n"
+                                         "int first = int(header.x + 0.5) + int(header.y + 0.5) * 65536;\n"
+                                         "int count = int(header.z + 0.5);\n"
+                                         "vec2 winding = vec2(0.0);\n"
+                                         "for(int i=0; i < count; i++){\n"
+                                             "vec4 c01 = texelFetch(curve_sampler, first + 2 * i) - p.xyxy;\n"
+                                             "vec2 c2 = texelFetch(curve_sampler, first + 2 * i + 1).xy - p;\n"
+                                             "vec3 x = vec3(c01.x, c01.z, c2.x), y = vec3(c01.y, c01.w, c2.y);\n"
+                                             "winding.x += crossing(y, x, pixel.x);\n"
+                                             "winding.y += crossing(x, y, pixel.y);\n"
+                                         "}\n"
+                                         "float coverage = clamp(0.5 * (abs(winding.x) + abs(winding.y)), 0.0, 1.0);\n"
+                                         "frag_colour = vec4(color.rgb, coverage * color.a);\n"
+                                     "}\n";
+
+
+/* Distance field atlases (see FontAtlas::setSdfRendering) and the string effects (see
+ * Text2D::setStringEffect), three vec4 per effect picked by the integer part of st.y / 2. The
+ * texels hold 128 at the edge and 128 / ATLAS_SDF_SPREAD levels per pixel, growing inwards. */
+const GLchar sdf_frag_shader[] = "#version 410\n"
+                                 "in vec2 st;\n"
+                                 "in vec4 color;\n"
+                                 "out vec4 frag_colour;\n"
+
+                                 "uniform sampler2D texture_sampler;\n"
+                                 "uniform vec4 effects[51];\n" // 3 * (TEXT_MAX_EFFECTS + 1)
+
+                                 // distance to the edge in screen pixels, positive inside
+                                 "float distance(vec2 uv, float texels){\n"
+                                     "return (texture(texture_sampler, uv).r * 255.0 - 128.0) / 16.0 / texels;\n"
+                                 "}\n"
+
+                                 "void main(){\n"
+                                     "int effect = int(st.y / 2.0);\n" // EFFECT_TEX_STRIDE
+                                     "vec2 uv = st - vec2(0.0, 2.0 * float(effect));\n"
+                                     "vec2 size = vec2(textureSize(texture_sampler, 0));\n"
+                                     "float texels = max(length(dFdx(uv) * size), 1e-4);\n" // per screen pixel
+                                     "float d = distance(uv, texels);\n"
+                                     "vec4 outline_color = effects[3 * effect];\n"
+                                     "vec4 shadow_color = effects[3 * effect + 1];\n"
+                                     "vec4 params = effects[3 * effect + 2];\n"
+
+                                     "float a = clamp(d + 0.5, 0.0, 1.0) * color.a;\n"
+                                     "vec4 result = vec4(color.rgb * a, a);\n"
+                                     "if(params.x > 0.0){\n"
+                                         "a = clamp(d + params.x + 0.5, 0.0, 1.0) * outline_color.a;\n"
+                                         "result += (1.0 - result.a) * vec4(outline_color.rgb * a, a);\n"
+                                     "}\n"
+                                     "if(shadow_color.a > 0.0){\n"
+                                         "float sd = distance(uv - vec2(params.y, -params.z) * texels / size, texels);\n"
+                                         "a = clamp(sd / max(params.w, 1.0) + 0.5, 0.0, 1.0) * shadow_color.a;\n"
+                                         "result += (1.0 - result.a) * vec4(shadow_color.rgb * a, a);\n"
+                                     "}\n"
+                                     "frag_colour = vec4(result.rgb / max(result.a, 1e-4), result.a);\n"
+                                 "}\n";
+
+
 const GLchar vert_shader[] = "#version 410\n"
                              "layout(location = 0) in vec2 vertex;\n"
                              "layout(location = 1) in vec2 tex_coord;\n"
@@ -129,6 +242,42 @@ int get_program(GLuint& program){
 }
 
 
+int get_lcd_program(GLuint& program){
+    GLuint vert, frag;
+    if(create_shader(vert_shader, vert, GL_VERTEX_SHADER) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    if(create_shader(lcd_frag_shader, frag, GL_FRAGMENT_SHADER) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    if(create_program(vert, frag, program) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+
+int get_outline_program(GLuint& program){
+    GLuint vert, frag;
+    if(create_shader(vert_shader, vert, GL_VERTEX_SHADER) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    if(create_shader(outline_frag_shader, frag, GL_FRAGMENT_SHADER) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    if(create_program(vert, frag, program) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+
+int get_effects_program(GLuint& program){
+    GLuint vert, frag;
+    if(create_shader(vert_shader, vert, GL_VERTEX_SHADER) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    if(create_shader(sdf_frag_shader, frag, GL_FRAGMENT_SHADER) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    if(create_program(vert, frag, program) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+
 int init_gl(GLFWwindow* window){
     glewExperimental = GL_TRUE;
 
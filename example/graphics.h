@@ -34,6 +34,17 @@ int create_program(GLuint vert, GLuint frag, GLuint &program_index);
 /* Returns the shader program that renders the text */
 int get_program(GLuint& program);
 
+/* Returns the shader program that renders text from atlases with LCD rendering */
+int get_lcd_program(GLuint& program);
+
+/* Returns the shader program that renders text from the atlas and, at large scales, from the
+ * glyph outlines (see FontAtlas::loadOutlines) */
+int get_outline_program(GLuint& program);
+
+/* Returns the shader program that renders text from distance field atlases, with the string
+ * effects (see Text2D::setStringEffect) */
+int get_effects_program(GLuint& program);
+
 /* Initializes the GL/GLEW. Returns EXIT_FAILURE on error */
 int init_gl(GLFWwindow* window);
 
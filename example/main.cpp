@@ -16,6 +16,8 @@
 
 #include <iostream>
 #include <cassert>
+#include <cwchar>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -33,8 +35,10 @@
 
 // text headers
 #include "../src/FontAtlas.h"
+#include "../src/FontRegistry.h"
 #include "../src/common.h"
 #include "../src/Text2D.h"
+#include "../src/TextView.h"
 
 // example headers
 #include "window.h"
@@ -45,6 +49,8 @@ GLFWwindow* window = nullptr;
 GLuint text_shader;
 
 Text2D* my_text_1 = nullptr;  // just used by the framebuffer callback
+TextView* my_view = nullptr;  // used by the callbacks when a text file is given
+FontAtlas* my_atlas = nullptr;  // re-baked in the background by the zoom keys
 
 
 void on_fb_resize_callback(GLFWwindow* window, int width, int height){
@@ -57,6 +63,8 @@ void on_fb_resize_callback(GLFWwindow* window, int width, int height){
     glViewport(0, 0, width, height);
 
     my_text_1->onFramebufferSizeUpdate(width, height);
+    if(my_view)
+        my_view->onFramebufferSizeUpdate(width, height);
 }
 
 
@@ -67,26 +75,44 @@ void on_kb_callback(GLFWwindow* window, int key, int scancode, int action, int m
     if(key == GLFW_KEY_UNKNOWN) return;
     if(key == GLFW_KEY_ESCAPE && action)
         glfwSetWindowShouldClose(window, true);
+
+    // zoom, the old glyphs are drawn until the new ones are ready
+    if(action && (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD))
+        my_atlas->rebake(nullptr, std::min(my_atlas->getFontSize() + 4, 128));
+    if(action && (key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT))
+        my_atlas->rebake(nullptr, std::max(my_atlas->getFontSize() - 4, 8));
+
+    if(my_view && action){
+        if(key == GLFW_KEY_DOWN)
+            my_view->scroll(1.0);
+        if(key == GLFW_KEY_UP)
+            my_view->scroll(-1.0);
+        if(key == GLFW_KEY_PAGE_DOWN)
+            my_view->scroll(20.0);
+        if(key == GLFW_KEY_PAGE_UP)
+            my_view->scroll(-20.0);
+    }
 }
 
 
 int main(int argc, char* argv[]){
     /*
      * Usage:
-     * ./main PATH_TO_FONT
+     * ./main PATH_TO_FONT [PATH_TO_TEXT_FILE]
      */
-    const char* path;
+    const char* path, *text_path = nullptr;
 
     if(argc < 2){
         std::cerr << "Missing argument path to font" << std::endl;
         return EXIT_FAILURE;
     }
-    else if(argc > 2){
+    else if(argc > 3){
         std::cerr << "Too many arguments" << std::endl;
         return EXIT_FAILURE;
     }
-    else
-        path = argv[1];
+    path = argv[1];
+    if(argc == 3)
+        text_path = argv[2];
 
     // init GLFW window
     window = init_window();
@@ -119,9 +145,13 @@ int main(int argc, char* argv[]){
     std::cerr << "Failed to load " << failed_chars << " characters" << std::endl;
     if(atlas.createAtlas(false))
         std::cerr << "Failed to create the complete atlas (out of space?)" << std::endl;
+    my_atlas = &atlas;
+    atlas.loadOutlines(); // the big text is drawn from the glyph outlines
+    std::cerr << "Font files mapped: " << FontRegistry::getFaceCount() << " ("
+              << FontRegistry::getMappedBytes() << " bytes)" << std::endl;
 
     // load shader
-    if(get_program(text_shader) == EXIT_FAILURE){
+    if(get_outline_program(text_shader) == EXIT_FAILURE){
         std::cerr << "Failed to create text shaders" << std::endl;
         return EXIT_FAILURE;
     }
@@ -156,19 +186,53 @@ int main(int argc, char* argv[]){
     text.addString(L"Faded green test rgba = [0., 1., 0., .5]", 50., 100., 0.5, 
                    STRING_DRAW_ABSOLUTE_TR, STRING_ALIGN_LEFT, faded_green);
 
+#ifdef PTT_PROFILE
+    text.setStatsDump("text_stats.csv", STATS_DUMP_CSV);
+#endif // PTT_PROFILE
+
+    struct string_span spans[2] = {{6, 3, {1.f, 0.f, 0.f, 1.f}}, {19, 5, {0.f, 1.f, 0.f, 1.f}}};
+    text.addString(L"Words red and also green in the same string", 50., 150., 0.5,
+                   STRING_DRAW_ABSOLUTE_TR, STRING_ALIGN_LEFT, nice_white, spans, 2);
+
+    // scrollable view of a text file (arrows/page up/page down), only the visible lines are laid out
+    MappedTextFile text_file;
+    if(text_path){
+        if(text_file.open(text_path) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+        my_view = new TextView(vp_data[2], vp_data[3], &atlas, text_shader, 0, vp_data[3] / 2,
+                               vp_data[2], vp_data[3] / 2, 0.5, nice_white);
+        my_view->setSource([&text_file](size_t line, wchar_t* buffer, uint buffer_len){
+                               text_file.getLine(line, buffer, buffer_len);
+                           }, text_file.getLineCount());
+    }
+
+    // frame time, redrawn every frame in immediate mode
+    struct text_style counter_style = {0.5f, STRING_ALIGN_RIGHT, {1.f, 1.f, 0.f, 1.f}, 0};
+    wchar_t counter[64];
+    double last_time = glfwGetTime(), now;
+
     // main loop
     while(!glfwWindowShouldClose(window)){
         glfwPollEvents();
+        atlas.swapRebaked();
+
+        now = glfwGetTime();
+        std::swprintf(counter, 64, L"%.2f ms", (now - last_time) * 1000.0);
+        last_time = now;
+        text.drawText(10.f, vp_data[3] - 20.f, counter, counter_style);
 
         glClearColor(.1f, 0.1f, 0.1f, 0.1f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         text.render();
+        if(my_view)
+            my_view->render();
 
         check_gl_errors(true);
         glfwSwapBuffers(window);
     }
 
+    delete my_view;
     glfwTerminate();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <utility>
+#ifdef DEBUG
+    #include <cassert>
+#endif // DEBUG
+
+#include "Bidi.h"
+
+
+// nesting of the bracket pairs (BD16), the pairs are not resolved beyond it
+#define BIDI_MAX_BRACKET_DEPTH 63
+
+
+static inline bool in_range(uint code, uint first, uint last){
+    return code >= first && code <= last;
+}
+
+
+uint bidi_type(wchar_t character){
+    uint code = character;
+
+    if(code < 0x80){
+        if(in_range(code, 'a', 'z') || in_range(code, 'A', 'Z'))
+            return BIDI_L;
+        if(in_range(code, '0', '9'))
+            return BIDI_EN;
+        switch(code){
+            case '+': case '-':
+                return BIDI_ES;
+            case '#': case '$': case '%':
+                return BIDI_ET;
+            case ',': case '.': case '/': case ':':
+                return BIDI_CS;
+            case ' ': case '\f':
+                return BIDI_WS;
+            case '\t': case '\v': case '\r': case 0x1f:
+                return BIDI_S;
+            default:
+                return BIDI_ON;
+        }
+    }
+
+    // hebrew, arabic and their presentation forms
+    if(in_range(code, 0x0590, 0x08ff) || in_range(code, 0xfb1d, 0xfdff) ||
+       in_range(code, 0xfe70, 0xfeff)){
+        if(in_range(code, 0x0591, 0x05bd) || code == 0x05bf || in_range(code, 0x05c1, 0x05c2) ||
+           in_range(code, 0x05c4, 0x05c5) || code == 0x05c7 || in_range(code, 0x0610, 0x061a) ||
+           in_range(code, 0x064b, 0x065f) || code == 0x0670 || in_range(code, 0x06d6, 0x06dc) ||
+           in_range(code, 0x06df, 0x06e4) || in_range(code, 0x06e7, 0x06e8) ||
+           in_range(code, 0x06ea, 0x06ed) || code == 0xfb1e)
+            return BIDI_NSM;
+        if(in_range(code, 0x0600, 0x0605) || in_range(code, 0x0660, 0x0669) ||
+           in_range(code, 0x066b, 0x066c) || code == 0x06dd)
+            return BIDI_AN;
+        if(in_range(code, 0x06f0, 0x06f9))
+            return BIDI_EN;
+        if(code == 0x066a)
+            return BIDI_ET;
+        if(code == 0x060c)
+            return BIDI_CS;
+        if(in_range(code, 0x0590, 0x05ff) || in_range(code, 0x07c0, 0x085f) ||
+           in_range(code, 0xfb1d, 0xfb4f))
+            return BIDI_R;
+        return BIDI_AL;
+    }
+    if(in_range(code, 0x10800, 0x10fff) || in_range(code, 0x1e800, 0x1efff) || code == 0x200f)
+        return BIDI_R;
+
+    if(code == 0x00aa || code == 0x00b5 || code == 0x00ba || code == 0x200e)
+        return BIDI_L;
+    if(code == 0x00b2 || code == 0x00b3 || code == 0x00b9 || in_range(code, 0x2070, 0x2079) ||
+       in_range(code, 0x2080, 0x2089) || in_range(code, 0xff10, 0xff19))
+        return BIDI_EN;
+    if(in_range(code, 0x00a2, 0x00a5) || in_range(code, 0x00b0, 0x00b1) ||
+       in_range(code, 0x2030, 0x2034) || in_range(code, 0x20a0, 0x20cf))
+        return BIDI_ET;
+    if(code == 0x00a0 || code == 0x202f || code == 0x2044)
+        return BIDI_CS;
+    if(code == 0x2212)
+        return BIDI_ES;
+    if(in_range(code, 0x0300, 0x036f))
+        return BIDI_NSM;
+    if(in_range(code, 0x2000, 0x200a) || code == 0x2028 || code == 0x1680 || code == 0x3000)
+        return BIDI_WS;
+    if(code == 0x2029 || code == 0x0085)
+        return BIDI_S;
+    if(in_range(code, 0x00a1, 0x00bf) || code == 0x00d7 || code == 0x00f7 ||
+       in_range(code, 0x200b, 0x2027) || in_range(code, 0x202a, 0x206f) ||
+       in_range(code, 0x2100, 0x214f) || in_range(code, 0x2190, 0x2bff) ||
+       in_range(code, 0x3001, 0x3003) || in_range(code, 0xfe30, 0xfe4f))
+        return BIDI_ON; // the ranges have a few letters, drawn as neutrals
+    return BIDI_L;
+}
+
+
+wchar_t bidi_mirror(wchar_t code){
+    static const wchar_t pairs[][2] = {{'(', ')'}, {'<', '>'}, {'[', ']'}, {'{', '}'},
+                                       {0x00ab, 0x00bb}, {0x2039, 0x203a}, {0x2045, 0x2046},
+                                       {0x2264, 0x2265}, {0x2208, 0x220b}, {0x3008, 0x3009},
+                                       {0x300a, 0x300b}, {0x300c, 0x300d}};
+
+    for(uint i=0; i < sizeof(pairs) / sizeof(pairs[0]); i++){
+        if(pairs[i][0] == code)
+            return pairs[i][1];
+        if(pairs[i][1] == code)
+            return pairs[i][0];
+    }
+    return code;
+}
+
+
+static inline bool is_opening_bracket(wchar_t code){
+    return code == '(' || code == '[' || code == '{' || code == 0x2045 || code == 0x3008 ||
+           code == 0x300a || code == 0x300c;
+}
+
+
+static inline bool is_strong(uint type){
+    return type == BIDI_L || type == BIDI_R || type == BIDI_EN || type == BIDI_AN;
+}
+
+
+static inline bool is_neutral(uint type){
+    return type == BIDI_ON || type == BIDI_WS || type == BIDI_S;
+}
+
+
+// direction of a resolved type for the neutrals (N0, N1), the numbers count as R
+static inline uint strong_direction(uint type){
+    return type == BIDI_L ? BIDI_L : BIDI_R;
+}
+
+
+// N0: both brackets of a pair (BD16) take the direction of their content, or of their context
+static void resolve_brackets(const wchar_t* text, uint n, uint e, uint8_t* t){
+    static thread_local std::vector<std::pair<uint, uint>> pairs; // keeps its memory
+    uint stack[BIDI_MAX_BRACKET_DEPTH], depth = 0;
+
+    pairs.clear();
+
+    for(uint i=0; i < n; i++){
+        if(t[i] != BIDI_ON)
+            continue;
+        if(is_opening_bracket(text[i])){
+            if(depth == BIDI_MAX_BRACKET_DEPTH)
+                break;
+            stack[depth++] = i;
+        }
+        else if(is_opening_bracket(bidi_mirror(text[i]))){
+            for(uint s=depth; s-- > 0;){
+                if(text[stack[s]] == bidi_mirror(text[i])){
+                    pairs.push_back(std::make_pair(stack[s], i));
+                    depth = s;
+                    break;
+                }
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    for(uint i=0; i < pairs.size(); i++){
+        uint open = pairs[i].first, close = pairs[i].second, direction = e;
+        bool inside = false, opposite = false;
+
+        for(uint j=open + 1; j < close && !inside; j++){
+            if(is_strong(t[j])){
+                inside = strong_direction(t[j]) == e;
+                opposite = !inside;
+            }
+        }
+        if(!inside && !opposite) // no strong type inside, left to N1
+            continue;
+        if(opposite){ // the opposite direction wins if the context before has it too
+            uint before = e;
+            for(uint j=open; j-- > 0;){
+                if(is_strong(t[j])){
+                    before = strong_direction(t[j]);
+                    break;
+                }
+            }
+            if(before != e)
+                direction = before;
+        }
+        t[open] = t[close] = direction;
+    }
+}
+
+
+static void reorder_line(const wchar_t* text, uint start, uint end, uint8_t* types,
+                         uint8_t* levels, std::vector<uint16_t>& order){
+    uint n = end - start, paragraph = 0, e, last, first_order = order.size();
+    uint8_t max_level = 0, min_odd_level = 0xff;
+    bool trailing = true;
+    uint8_t* t = types + start, *lv = levels + start;
+
+    if(!n)
+        return;
+
+    for(uint i=0; i < n; i++)
+        t[i] = bidi_type(text[start + i]);
+    // P2, P3: the first strong character sets the paragraph level
+    for(uint i=0; i < n && t[i] != BIDI_L; i++){
+        if(t[i] == BIDI_R || t[i] == BIDI_AL){
+            paragraph = 1;
+            break;
+        }
+    }
+    e = paragraph ? BIDI_R : BIDI_L; // also the start and end of sequence types
+
+    // W1: marks take the type of the previous character
+    last = e;
+    for(uint i=0; i < n; i++){
+        if(t[i] == BIDI_NSM)
+            t[i] = last;
+        else
+            last = t[i];
+    }
+    // W2, W3: european numbers after arabic letters are arabic numbers
+    last = e;
+    for(uint i=0; i < n; i++){
+        if(t[i] == BIDI_EN && last == BIDI_AL)
+            t[i] = BIDI_AN;
+        else if(t[i] == BIDI_L || t[i] == BIDI_R || t[i] == BIDI_AL)
+            last = t[i];
+    }
+    for(uint i=0; i < n; i++){
+        if(t[i] == BIDI_AL)
+            t[i] = BIDI_R;
+    }
+    // W4: a single separator between two numbers of the same kind
+    for(uint i=1; i + 1 < n; i++){
+        if(t[i - 1] != t[i + 1])
+            continue;
+        if((t[i] == BIDI_ES || t[i] == BIDI_CS) && t[i - 1] == BIDI_EN)
+            t[i] = BIDI_EN;
+        else if(t[i] == BIDI_CS && t[i - 1] == BIDI_AN)
+            t[i] = BIDI_AN;
+    }
+    // W5: terminators next to european numbers
+    for(uint i=0; i < n; i++){
+        uint j = i;
+        if(t[i] != BIDI_ET)
+            continue;
+        while(j < n && t[j] == BIDI_ET)
+            j++;
+        if((i > 0 && t[i - 1] == BIDI_EN) || (j < n && t[j] == BIDI_EN))
+            std::fill(t + i, t + j, BIDI_EN);
+        i = j - 1;
+    }
+    // W6, W7: the remaining separators are neutrals, european numbers after L are L
+    last = e;
+    for(uint i=0; i < n; i++){
+        if(t[i] == BIDI_ES || t[i] == BIDI_ET || t[i] == BIDI_CS)
+            t[i] = BIDI_ON;
+        else if(t[i] == BIDI_EN && last == BIDI_L)
+            t[i] = BIDI_L;
+        else if(t[i] == BIDI_L || t[i] == BIDI_R)
+            last = t[i];
+    }
+    resolve_brackets(text + start, n, e, t);
+    // N1, N2: neutrals between the same direction take it, the paragraph one otherwise
+    for(uint i=0; i < n; i++){
+        uint j = i, before, after;
+        if(!is_neutral(t[i]))
+            continue;
+        while(j < n && is_neutral(t[j]))
+            j++;
+        before = i > 0 ? strong_direction(t[i - 1]) : e;
+        after = j < n ? strong_direction(t[j]) : e;
+        std::fill(t + i, t + j, before == after ? before : e);
+        i = j - 1;
+    }
+    // I1, I2
+    for(uint i=0; i < n; i++){
+        if(!paragraph)
+            lv[i] = t[i] == BIDI_R ? 1 : (t[i] == BIDI_AN || t[i] == BIDI_EN ? 2 : 0);
+        else
+            lv[i] = t[i] == BIDI_R ? 1 : 2;
+    }
+    // L1: separators and the whitespace before them or the end of the line
+    for(uint i=n; i-- > 0;){
+        uint type = bidi_type(text[start + i]);
+        if(type == BIDI_S){
+            lv[i] = paragraph;
+            trailing = true;
+        }
+        else if(type == BIDI_WS){
+            if(trailing)
+                lv[i] = paragraph;
+        }
+        else{
+            trailing = false;
+        }
+    }
+
+    // L2: reverse every run at each level, from the highest to the lowest odd one
+    for(uint i=0; i < n; i++){
+        order.push_back(i);
+        max_level = std::max(max_level, lv[i]);
+        if(lv[i] & 1)
+            min_odd_level = std::min(min_odd_level, lv[i]);
+    }
+    uint16_t* visual = &order[first_order];
+    for(uint8_t level = max_level; level >= min_odd_level && level > 0; level--){
+        for(uint i=0; i < n; i++){
+            uint j = i;
+            if(lv[visual[i]] < level)
+                continue;
+            while(j < n && lv[visual[j]] >= level)
+                j++;
+            std::reverse(visual + i, visual + j);
+            i = j - 1;
+        }
+    }
+
+    for(uint i=0; i < n; i++){
+        uint index = visual[i];
+        visual[i] = (start + index) | (lv[index] & 1 ? BIDI_RTL : 0) |
+                    (paragraph ? BIDI_RTL_LINE : 0);
+    }
+}
+
+
+bool bidi_reorder(const wchar_t* text, std::vector<uint16_t>& order){
+#ifdef DEBUG
+    assert(text);
+#endif // DEBUG
+    static thread_local std::vector<uint8_t> types, levels; // only grow
+    bool rtl = false;
+    uint len;
+
+    order.clear();
+    for(len=0; text[len] != '\0'; len++){
+        if(!rtl && text[len] >= 0x0590){
+            uint type = bidi_type(text[len]);
+            rtl = type == BIDI_R || type == BIDI_AL || type == BIDI_AN;
+        }
+    }
+    // only left to right and neutral characters, nothing moves
+    if(!rtl || len > BIDI_OFFSET_MASK)
+        return false;
+
+    if(types.size() < len){
+        types.resize(len);
+        levels.resize(len);
+    }
+    for(uint start=0; start <= len;){
+        uint end = start;
+        while(end < len && text[end] != '\n')
+            end++;
+        reorder_line(text, start, end, types.data(), levels.data(), order);
+        start = end + 1;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef BIDI_H
+#define BIDI_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <vector>
+
+
+// bidirectional character types (UAX #9), the explicit formatting ones are treated as ON
+#define BIDI_L 0 // left to right
+#define BIDI_R 1 // right to left
+#define BIDI_AL 2 // arabic letter
+#define BIDI_EN 3 // european number
+#define BIDI_ES 4 // european separator
+#define BIDI_ET 5 // european terminator
+#define BIDI_AN 6 // arabic number
+#define BIDI_CS 7 // common separator
+#define BIDI_NSM 8 // nonspacing mark
+#define BIDI_S 9 // segment separator
+#define BIDI_WS 10 // whitespace
+#define BIDI_ON 11 // other neutral
+
+// entries of the visual order (see bidi_reorder)
+#define BIDI_OFFSET_MASK 0x3fff
+#define BIDI_RTL 0x8000 // the character is drawn right to left, mirrored if it has a mirror
+#define BIDI_RTL_LINE 0x4000 // the line is a right to left paragraph
+
+uint bidi_type(wchar_t code);
+// the mirrored glyph of brackets and other paired characters, the same code for the rest
+wchar_t bidi_mirror(wchar_t code);
+
+/* Visual order of every line of the text, each line is a paragraph (UAX #9 rules P2-P3,
+ * W1-W7, N0-N2, I1-I2 and L1-L2, without explicit embeddings nor isolates). order gets the
+ * offsets in the text of the characters of each line from left to right, line breaks
+ * excluded, with the BIDI_* flags. Returns false and leaves order empty if the text has
+ * nothing to reorder, or if it's longer than BIDI_OFFSET_MASK. */
+bool bidi_reorder(const wchar_t* text, std::vector<uint16_t>& order);
+
+#endif
@@ -16,6 +16,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <cmath>
 #include <stdexcept>
 #include <iostream>
 
@@ -23,23 +24,52 @@
     #include <cassert>
 #endif
 
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
 #ifdef SAVE_STB
     #include <stb_image_write.h>
 #endif
-#include <GL/glew.h>
+#ifndef PTT_NO_GL
+    #include <GL/glew.h>
+#endif // PTT_NO_GL
 
 #include "FontAtlas.h"
+#include "FontRegistry.h"
 #include "common.h"
 
 
 FontAtlas::FontAtlas(){
-    if (FT_Init_FreeType(&m_ft)){
-        std::cerr << "FontAtlas::FontAtlas: Freetype error - could not initialize the FreeType" 
-                  << std::endl;
-    }
+    m_face = nullptr;
+    m_size = nullptr;
+    m_font_size = 0;
+    m_rebake_done = false;
+    m_rebake_failed = false;
+    m_texture_id = 0;
+    m_curve_buffer = 0;
+    m_curve_texture = 0;
+    m_glyph_buffer = 0;
+    m_glyph_buffer_generation = 0;
+    m_num_gpu_glyphs = 0;
     m_atlas_size = 512;
     m_atlas.reset(nullptr);
     m_font_height = 0;
+    m_ascender = 0;
+    m_packing_mode = ATLAS_PACK_HEIGHT;
+    m_texture_options = 0;
+    m_gpu_bytes = 0;
+    m_subpixel_phases = 1;
+    m_subpixel_budget = 0;
+    m_lcd = false;
+    m_sdf = false;
+    m_generation = 1;
+    m_fingerprint = 0;
+    m_styles.assign(1, font_style());
+    m_style_glyphs.assign(1, 0);
+#ifdef PTT_PROFILE
+    m_fallback_hits = 0;
+#endif // PTT_PROFILE
 }
 
 
@@ -48,20 +78,52 @@ FontAtlas::FontAtlas(uint atlas_size){
     assert(atlas_size);
     assert(!(atlas_size & (atlas_size - 1))); // atlas size must be a power of 2
 #endif // DEBUG
-    if (FT_Init_FreeType(&m_ft)){
-        std::cerr << "FontAtlas::FontAtlas:Freetype error - could not initialize FreeType" 
-                  << std::endl;
-    }
+    m_face = nullptr;
+    m_size = nullptr;
+    m_font_size = 0;
+    m_rebake_done = false;
+    m_rebake_failed = false;
+    m_texture_id = 0;
+    m_curve_buffer = 0;
+    m_curve_texture = 0;
+    m_glyph_buffer = 0;
+    m_glyph_buffer_generation = 0;
+    m_num_gpu_glyphs = 0;
     m_atlas_size = atlas_size;
     m_atlas.reset(nullptr);
     m_font_height = 0;
+    m_ascender = 0;
+    m_packing_mode = ATLAS_PACK_HEIGHT;
+    m_texture_options = 0;
+    m_gpu_bytes = 0;
+    m_subpixel_phases = 1;
+    m_subpixel_budget = 0;
+    m_lcd = false;
+    m_sdf = false;
+    m_generation = 1;
+    m_fingerprint = 0;
+    m_styles.assign(1, font_style());
+    m_style_glyphs.assign(1, 0);
+#ifdef PTT_PROFILE
+    m_fallback_hits = 0;
+#endif // PTT_PROFILE
 }
 
 
 FontAtlas::~FontAtlas(){
-    if(m_ft)
-        FT_Done_FreeType(m_ft);
+    if(m_rebake_thread.joinable())
+        m_rebake_thread.join();
+    if(m_face){
+        std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+        FT_Done_Size(m_size);
+        FontRegistry::release(m_face);
+    }
+#ifndef PTT_NO_GL
     glDeleteTextures(1, &m_texture_id);
+    glDeleteTextures(1, &m_curve_texture);
+    glDeleteBuffers(1, &m_curve_buffer);
+    glDeleteBuffers(1, &m_glyph_buffer);
+#endif // PTT_NO_GL
 }
 
 
@@ -70,14 +132,28 @@ uint FontAtlas::loadFont(const char* path, int size){
     assert(path);
     assert(size > 0);
 #endif // DEBUG
-    if (FT_New_Face(m_ft, path, 0, &m_face)){
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+
+    if(m_face){
+        FT_Done_Size(m_size);
+        FontRegistry::release(m_face);
+    }
+
+    clearOutlines();
+    m_face = FontRegistry::acquire(path);
+    if(!m_face){
 #ifdef DEBUG
         std::cout << "FontAtlas::loadFont: Freetype error: failed to load font " << path
                   << std::endl;
 #endif // DEBUG
         return EXIT_FAILURE;
     }
+    // the face is shared, each atlas has its own size object that is activated before use
+    FT_New_Size(m_face, &m_size);
+    FT_Activate_Size(m_size);
     FT_Set_Pixel_Sizes(m_face, 0, size);
+    m_font_path = path;
+    m_font_size = size;
     loadCharacter(0); // load default
 
     return EXIT_SUCCESS;
@@ -89,108 +165,353 @@ bool comparator(const character& a, const character& b){
 }
 
 
+bool code_comparator(const character& a, const character& b){
+    return a.code < b.code;
+}
+
+
+bool is_variant(const character& ch){
+    return ch.phase || ch.style;
+}
+
+
+// num_axes indexes fixed size arrays, the styles read from a file have to be checked
+bool is_valid_style(const font_style& style){
+    return style.num_axes <= FONT_STYLE_MAX_AXES && std::isfinite(style.embolden) &&
+           std::isfinite(style.oblique);
+}
+
+
+struct frequency_comparator{
+    const std::unordered_map<uint, uint>& frequencies;
+
+    uint frequency(uint code) const{
+        std::unordered_map<uint, uint>::const_iterator it = frequencies.find(code);
+        return it == frequencies.end() ? 0 : it->second;
+    }
+
+    bool operator()(const character& a, const character& b) const{
+        uint freq_a = frequency(a.code), freq_b = frequency(b.code);
+        if(freq_a != freq_b)
+            return freq_a > freq_b;
+        return a.height > b.height;
+    }
+};
+
+
+uint FontAtlas::renderGlyph(uint glyph_index, uint phase, uint style){
+    FT_Int32 flags = FT_LOAD_DEFAULT;
+    FT_Render_Mode mode = FT_RENDER_MODE_NORMAL;
+    FT_Pos embolden = m_styles[style].embolden * 64.0f;
+
+    if(m_lcd){
+        flags |= FT_LOAD_TARGET_LCD;
+        mode = FT_RENDER_MODE_LCD;
+    }
+    else if(m_subpixel_phases > 1){
+        flags |= FT_LOAD_TARGET_LIGHT; // no horizontal hinting, it would undo the phase
+    }
+    if(m_sdf && !m_lcd)
+        mode = FT_RENDER_MODE_SDF;
+
+    applyStyle(style);
+    if(FT_Load_Glyph(m_face, glyph_index, flags))
+        return 1;
+    if(phase && m_face->glyph->format == FT_GLYPH_FORMAT_OUTLINE)
+        FT_Outline_Translate(&m_face->glyph->outline, phase * 64 / m_subpixel_phases, 0);
+    // as FT_GlyphSlot_Embolden but with the strength of the style, bitmap fonts stay as they are
+    if(embolden > 0 && m_face->glyph->format == FT_GLYPH_FORMAT_OUTLINE){
+        FT_Outline_EmboldenXY(&m_face->glyph->outline, embolden, embolden);
+        m_face->glyph->advance.x += embolden;
+    }
+
+    return FT_Render_Glyph(m_face->glyph, mode) ? 1 : 0;
+}
+
+
+void FontAtlas::addCharacter(uint code, uint glyph_index, uint phase, uint style){
+    m_characters_vec.push_back(character());
+    struct character& ch = m_characters_vec.back();
+
+    ch.code = code;
+    ch.glyph_index = glyph_index;
+    ch.phase = phase;
+    ch.style = style;
+    ch.width = m_face->glyph->bitmap.width / (m_lcd ? 3 : 1);
+    ch.height = m_face->glyph->bitmap.rows;
+    ch.bearing_x = m_face->glyph->bitmap_left;
+    ch.bearing_y = m_face->glyph->bitmap_top;
+    ch.advance_x = m_face->glyph->advance.x;
+    ch.advance_y = m_face->glyph->advance.y;
+}
+
+
 uint FontAtlas::loadCharacterRange(uint start, uint end){
-    uint glyph_index, index = 0;
+    uint glyph_index;
     uint failed = 0;
 
-    if(!m_characters_vec.empty())
-        index = m_characters_vec.size();
+    if(!m_face)
+        return end - start + 1;
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
 
+    FT_Activate_Size(m_size);
     for(uint i=start; i<=end; i++){
         glyph_index = FT_Get_Char_Index(m_face, i);
 
-        if(!FT_Load_Glyph(m_face, glyph_index, FT_LOAD_RENDER) && glyph_index){
-            m_characters_vec.push_back(character());
-            m_characters_vec.at(index).code = i;
-            m_characters_vec.at(index).glyph_index = glyph_index;
-            m_characters_vec.at(index).width = m_face->glyph->bitmap.width;
-            m_characters_vec.at(index).height = m_face->glyph->bitmap.rows;
-            m_characters_vec.at(index).bearing_x = m_face->glyph->bitmap_left;
-            m_characters_vec.at(index).bearing_y = m_face->glyph->bitmap_top;
-            m_characters_vec.at(index).advance_x = m_face->glyph->advance.x;
-            m_characters_vec.at(index).advance_y = m_face->glyph->advance.y;
-            index++;
-        }
-        else{
+        if(glyph_index && !renderGlyph(glyph_index, 0, 0))
+            addCharacter(i, glyph_index, 0, 0);
+        else
             failed++;
-        }
     }
     return failed;
 }
 
 
 uint FontAtlas::loadCharacter(uint code){
-    uint glyph_index, res, index = 0;
+    uint glyph_index;
 
-    if(!m_characters_vec.empty())
-        index = m_characters_vec.size();
+    if(!m_face)
+        return 1;
 
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+    FT_Activate_Size(m_size);
     glyph_index = FT_Get_Char_Index(m_face, code);
-    res = FT_Load_Glyph(m_face, glyph_index, FT_LOAD_RENDER);
-
-    if((!res)){
-        m_characters_vec.push_back(character());
-        m_characters_vec.at(index).code = code;
-        m_characters_vec.at(index).glyph_index = glyph_index;
-        m_characters_vec.at(index).width = m_face->glyph->bitmap.width;
-        m_characters_vec.at(index).height = m_face->glyph->bitmap.rows;
-        m_characters_vec.at(index).bearing_x = m_face->glyph->bitmap_left;
-        m_characters_vec.at(index).bearing_y = m_face->glyph->bitmap_top;
-        m_characters_vec.at(index).advance_x = m_face->glyph->advance.x;
-        m_characters_vec.at(index).advance_y = m_face->glyph->advance.y;
+    if(renderGlyph(glyph_index, 0, 0))
+        return 1;
+
+    addCharacter(code, glyph_index, 0, 0);
+    return 0;
+}
+
+
+void FontAtlas::loadPhaseVariants(){
+    std::vector<struct character> base;
+    size_t used = 0, variant_bytes;
+    uint count = m_characters_vec.size();
+
+    // the most used characters get their variants first when there's a corpus
+    for(uint i=0; i<count; i++){
+        if(m_characters_vec[i].phase)
+            continue;
+        if(m_frequencies.empty() || m_frequencies.count(m_characters_vec[i].code))
+            base.push_back(m_characters_vec[i]);
+    }
+    if(!m_frequencies.empty()){
+        frequency_comparator freq_comparator = {m_frequencies};
+        std::stable_sort(base.begin(), base.end(), freq_comparator);
+    }
+
+    for(uint i=0; i<base.size(); i++){
+        variant_bytes = (size_t)(phaseWidth(base[i]) + 1 + ATLAS_PADDING) * 
+                        (base[i].height + ATLAS_PADDING) * (m_subpixel_phases - 1);
+        if(used + variant_bytes > m_subpixel_budget)
+            break;
+        used += variant_bytes;
+
+        for(uint phase=1; phase<m_subpixel_phases; phase++)
+            if(!renderGlyph(base[i].glyph_index, phase, 0))
+                addCharacter(base[i].code, base[i].glyph_index, phase, 0);
+    }
+}
+
+
+void FontAtlas::loadStyleVariants(){
+    uint count = m_characters_vec.size();
+
+    for(uint style=1; style < m_styles.size(); style++){
+        if(m_style_glyphs[style] != style) // same glyphs as another style
+            continue;
+        for(uint i=0; i<count; i++){
+            const struct character ch = m_characters_vec[i]; // the vector grows
+            if(ch.phase || ch.style)
+                continue;
+            if(!renderGlyph(ch.glyph_index, 0, style))
+                addCharacter(ch.code, ch.glyph_index, 0, style);
+        }
+    }
+}
 
+
+void FontAtlas::applyStyle(uint style){
+    const struct font_style& instance = m_styles[style];
+    FT_Fixed coords[FONT_STYLE_MAX_AXES];
+
+    if(!FT_HAS_MULTIPLE_MASTERS(m_face))
+        return;
+    for(uint i=0; i < instance.num_axes; i++)
+        coords[i] = instance.axes[i] * 65536.0f;
+    FT_Set_Var_Design_Coordinates(m_face, instance.num_axes, coords);
+}
+
+
+uint FontAtlas::addStyle(const struct font_style& style){
+#ifdef DEBUG
+    assert(style.num_axes <= FONT_STYLE_MAX_AXES);
+#endif // DEBUG
+    if(m_styles.size() == FONT_MAX_STYLES){
+        std::cerr << "FontAtlas::addStyle: more than " << FONT_MAX_STYLES << " styles"
+                  << std::endl;
         return 0;
     }
-    else{
-        return 1;
+
+    m_styles.push_back(style);
+    if(style.num_axes && m_face && !FT_HAS_MULTIPLE_MASTERS(m_face)){
+        std::cerr << "FontAtlas::addStyle: " << m_font_path << " is not a variable font, "
+                  << "the axes are ignored" << std::endl;
+        m_styles.back().num_axes = 0;
     }
+    m_style_glyphs.push_back(styleGlyphs(m_styles.size() - 1));
+
+    return m_styles.size() - 1;
 }
 
 
-bool FontAtlas::createAtlas(bool save_png){ // check error codes
-    UNUSED(save_png);
-    uint glyph_index, pen_x = 1, pen_y = 1, max_heigth_row;
-    bool failed = false;
-    m_atlas.reset(new unsigned char[m_atlas_size*m_atlas_size]);
+uint FontAtlas::styleGlyphs(uint style) const{
+    const struct font_style& font = m_styles[style];
 
-    m_font_height = m_face->size->metrics.ascender - m_face->size->metrics.descender;
+    // only the oblique shear is left to the layout
+    for(uint i=0; i < style; i++){
+        const struct font_style& other = m_styles[i];
+        if(other.embolden == font.embolden && other.num_axes == font.num_axes &&
+           std::equal(font.axes, font.axes + font.num_axes, other.axes))
+            return i;
+    }
+    return style;
+}
 
-    std::sort(m_characters_vec.begin(), m_characters_vec.end(), comparator);
 
-    //let's create the atlas
-    std::memset(m_atlas.get(), 0, m_atlas_size*m_atlas_size);
+const struct font_style* FontAtlas::getStyle(uint style) const{
+    return style < m_styles.size() ? &m_styles[style] : nullptr;
+}
+
+
+uint FontAtlas::getStyleCount() const{
+    return m_styles.size();
+}
+
+
+uint FontAtlas::getVariationAxes(std::vector<struct font_axis>& axes) const{
+    FT_MM_Var* mm_var;
+
+    axes.clear();
+    if(!m_face || !FT_HAS_MULTIPLE_MASTERS(m_face))
+        return 0;
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+    if(FT_Get_MM_Var(m_face, &mm_var))
+        return 0;
+    for(uint i=0; i < mm_var->num_axis; i++){
+        struct font_axis axis;
+        axis.tag = mm_var->axis[i].tag;
+        axis.min = mm_var->axis[i].minimum / 65536.0f;
+        axis.def = mm_var->axis[i].def / 65536.0f;
+        axis.max = mm_var->axis[i].maximum / 65536.0f;
+        axes.push_back(axis);
+    }
+    FT_Done_MM_Var(m_face->glyph->library, mm_var);
+
+    return axes.size();
+}
+
+
+uint FontAtlas::loadCorpus(const wchar_t* text){
+#ifdef DEBUG
+    assert(text);
+#endif // DEBUG
+    std::unordered_set<uint> loaded;
+    uint failed = 0;
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+
+    for(uint i=0; i<m_characters_vec.size(); i++)
+        loaded.insert(m_characters_vec[i].code);
+
+    for(uint i=0; text[i] != '\0'; i++){
+        if(text[i] == '\n' || text[i] == '\r' || text[i] == '\t')
+            continue;
+
+        m_frequencies[text[i]]++;
+        if(!loaded.insert(text[i]).second)
+            continue;
+
+        // loadCharacter would bake the missing glyph for characters that are not in the font
+        if(!m_face || !FT_Get_Char_Index(m_face, text[i]))
+            failed++;
+        else
+            failed += loadCharacter(text[i]);
+    }
+    return failed;
+}
 
-    max_heigth_row = m_characters_vec[0].height;
+
+uint FontAtlas::loadCorpusFile(const char* path){
+#ifdef DEBUG
+    assert(path);
+#endif // DEBUG
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream buffer;
+    std::string text;
+    std::vector<wchar_t> decoded;
+
+    if(!file.is_open()){
+        std::cerr << "FontAtlas::loadCorpusFile: failed to open " << path << std::endl;
+        return 0;
+    }
+    buffer << file.rdbuf();
+    text = buffer.str();
+
+    decoded.resize(text.size() + 1);
+    utf8towstr(decoded.data(), text.data(), text.size(), decoded.size());
+
+    return loadCorpus(decoded.data());
+}
+
+
+void FontAtlas::getSubsetReport(struct subset_report& report){
+    std::unordered_set<uint> pages;
+    std::unordered_map<uint, uint>::const_iterator it;
+    uint glyph_index;
+
+    report.glyphs = 0;
+    report.bytes = 0;
+    report.baseline_glyphs = 0;
+    report.baseline_bytes = 0;
 
     for(uint i=0; i<m_characters_vec.size(); i++){
-        if(pen_x + m_characters_vec[i].width + 2 > m_atlas_size){
-            pen_y += max_heigth_row + 2; // new "row"
-            max_heigth_row = m_characters_vec[i].height;
-            pen_x = 0; // should this be one?
-            if(pen_y + max_heigth_row + 2 > m_atlas_size){ // out of space
-                failed = true;
-                break;
-            } // if there's no space left for the next row we stop
-        }
+        if(m_frequencies.find(m_characters_vec[i].code) == m_frequencies.end())
+            continue;
+        report.glyphs++;
+        report.bytes += (m_characters_vec[i].width + ATLAS_PADDING) *
+                        (m_characters_vec[i].height + ATLAS_PADDING);
+    }
 
-        m_characters_vec[i].tex_x_min = (float)pen_x / m_atlas_size;
-        m_characters_vec[i].tex_x_max = (float)(pen_x + m_characters_vec[i].width) / m_atlas_size;
-        m_characters_vec[i].tex_y_min = (float)pen_y / m_atlas_size;
-        m_characters_vec[i].tex_y_max = (float)(pen_y  + m_characters_vec[i].height) / m_atlas_size;
+    if(!m_face)
+        return;
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
 
-        glyph_index = FT_Get_Char_Index(m_face, m_characters_vec[i].code);
-        FT_Load_Glyph(m_face, glyph_index, FT_LOAD_RENDER);
+    for(it=m_frequencies.begin(); it != m_frequencies.end(); ++it)
+        pages.insert(it->first >> 8);
 
-        for(int j=0; j<m_characters_vec[i].height; j++){
-            std::copy(&m_face->glyph->bitmap.buffer[m_characters_vec[i].width * j],
-                      &m_face->glyph->bitmap.buffer[m_characters_vec[i].width * (j+1)],
-                      m_atlas.get() + pen_y * m_atlas_size + pen_x + m_atlas_size * j);
+    FT_Activate_Size(m_size);
+    for(std::unordered_set<uint>::iterator page=pages.begin(); page != pages.end(); ++page){
+        for(uint code=*page << 8; code < (*page + 1) << 8; code++){
+            glyph_index = FT_Get_Char_Index(m_face, code);
+            if(!glyph_index || FT_Load_Glyph(m_face, glyph_index, FT_LOAD_DEFAULT))
+                continue;
+            report.baseline_glyphs++;
+            report.baseline_bytes += 
+                (((m_face->glyph->metrics.width + 63) >> 6) + ATLAS_PADDING) *
+                (((m_face->glyph->metrics.height + 63) >> 6) + ATLAS_PADDING);
         }
-        pen_x += m_characters_vec[i].width + 2;
     }
+}
 
-    for(uint i=0; i<m_characters_vec.size(); i++)
-        m_characters[m_characters_vec[i].code] = m_characters_vec[i];
+
+bool FontAtlas::createAtlas(bool save_png){ // check error codes
+    UNUSED(save_png);
+    bool failed;
+
+    if(!m_face || m_characters_vec.empty())
+        return true;
+    failed = bakeAtlas();
 
 #ifdef SAVE_STB
     if(save_png)
@@ -211,30 +532,920 @@ bool FontAtlas::createAtlas(bool save_png){ // check error codes
 }
 
 
+bool FontAtlas::bakeAtlas(){
+    uint pen_x = 1, pen_y = 1, max_heigth_row, width;
+    std::unordered_map<uint64_t, uint> glyphs; // first character of each glyph
+    bool failed = false;
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+
+    m_atlas.reset(new unsigned char[m_atlas_size*m_atlas_size]);
+
+    FT_Activate_Size(m_size);
+    applyStyle(0);
+    m_font_height = m_size->metrics.ascender - m_size->metrics.descender;
+    m_ascender = m_size->metrics.ascender;
+
+    // drop the variants of a previous call, the budget or the characters may have changed
+    m_characters_vec.erase(std::remove_if(m_characters_vec.begin(), m_characters_vec.end(),
+                                          is_variant), m_characters_vec.end());
+    m_characters.clear();
+    if(m_subpixel_phases > 1)
+        loadPhaseVariants();
+    loadStyleVariants();
+
+    if(m_packing_mode == ATLAS_PACK_CODE){
+        std::sort(m_characters_vec.begin(), m_characters_vec.end(), code_comparator);
+    }
+    else if(m_packing_mode == ATLAS_PACK_FREQUENCY){
+        frequency_comparator freq_comparator = {m_frequencies};
+        std::sort(m_characters_vec.begin(), m_characters_vec.end(), freq_comparator);
+    }
+    else
+        std::sort(m_characters_vec.begin(), m_characters_vec.end(), comparator);
+
+    //let's create the atlas
+    std::memset(m_atlas.get(), 0, m_atlas_size*m_atlas_size);
+
+    max_heigth_row = 0;
+
+    for(uint i=0; i<m_characters_vec.size(); i++){
+        struct character& ch = m_characters_vec[i];
+
+        // code points with the same glyph (missing characters, aliases) share its pixels
+        uint64_t glyph_key = (uint64_t)ch.glyph_index << 32 |
+                             characterKey(0, ch.phase, m_style_glyphs[ch.style]);
+        std::pair<std::unordered_map<uint64_t, uint>::iterator, bool> packed =
+            glyphs.insert(std::make_pair(glyph_key, i));
+        if(!packed.second){
+            const struct character& other = m_characters_vec[packed.first->second];
+            ch.tex_x_min = other.tex_x_min;
+            ch.tex_x_max = other.tex_x_max;
+            ch.tex_y_min = other.tex_y_min;
+            ch.tex_y_max = other.tex_y_max;
+            continue;
+        }
+
+        width = phaseWidth(ch);
+        if(pen_x + width + ATLAS_PADDING > m_atlas_size){
+            pen_y += max_heigth_row + ATLAS_PADDING; // new "row"
+            max_heigth_row = 0;
+            pen_x = 0; // should this be one?
+        }
+        // only the height mode sorts the tallest first, any glyph of the row can be the tallest
+        if(pen_x + width + ATLAS_PADDING > m_atlas_size ||
+           pen_y + ch.height + ATLAS_PADDING > m_atlas_size){ // out of space
+            failed = true;
+            break;
+        }
+        max_heigth_row = std::max(max_heigth_row, (uint)ch.height);
+
+        m_characters_vec[i].tex_x_min = (float)pen_x / m_atlas_size;
+        m_characters_vec[i].tex_x_max = (float)(pen_x + width) / m_atlas_size;
+        m_characters_vec[i].tex_y_min = (float)pen_y / m_atlas_size;
+        m_characters_vec[i].tex_y_max = (float)(pen_y  + m_characters_vec[i].height) / m_atlas_size;
+
+        renderGlyph(ch.glyph_index, ch.phase, ch.style);
+
+        for(int j=0; j<m_characters_vec[i].height; j++){
+            const unsigned char* row = m_face->glyph->bitmap.buffer + 
+                                       m_face->glyph->bitmap.pitch * j;
+            std::copy(row, row + width, 
+                      m_atlas.get() + pen_y * m_atlas_size + pen_x + m_atlas_size * j);
+        }
+        pen_x += width + ATLAS_PADDING;
+    }
+
+    for(uint i=0; i<m_characters_vec.size(); i++)
+        m_characters[characterKey(m_characters_vec[i].code, m_characters_vec[i].phase,
+                                  m_characters_vec[i].style)] = m_characters_vec[i];
+    m_metrics_cache.clear();
+    m_generation++;
+    updateFingerprint();
+
+    return failed;
+}
+
+
 int FontAtlas::getCharacter(uint code, const character** the_character) const{
 #ifdef DEBUG
     assert(the_character);
 #endif // DEBUG
-    try{
-        *the_character = &m_characters.at(code);
+    std::unordered_map<uint, struct character>::const_iterator it = m_characters.find(code);
+
+    if(it != m_characters.end()){
+        *the_character = &it->second;
+        return EXIT_SUCCESS;
     }
-    catch(const std::out_of_range& e){
-        // if no character matches it returns the null character.
-        *the_character = &m_characters.at(0);
-        return EXIT_FAILURE;
+    // if no character matches it returns the null character, without throwing as text in
+    // scripts the font lacks misses on every glyph
+    *the_character = &m_characters.at(0);
+#ifdef PTT_PROFILE
+    m_fallback_hits++;
+#endif // PTT_PROFILE
+    return EXIT_FAILURE;
+}
+
+
+int FontAtlas::getCharacter(uint code, uint phase, const character** the_character) const{
+#ifdef DEBUG
+    assert(the_character);
+#endif // DEBUG
+    std::unordered_map<uint, struct character>::const_iterator it;
+
+    if(phase){
+        it = m_characters.find(characterKey(code, phase, 0));
+        if(it != m_characters.end()){
+            *the_character = &it->second;
+            return EXIT_SUCCESS;
+        }
     }
-    return EXIT_SUCCESS;
+    // no variant for this phase (out of budget), phase 0 is returned instead
+    return getCharacter(code, the_character);
+}
+
+
+int FontAtlas::getCharacter(uint code, uint phase, uint style,
+                            const character** the_character) const{
+#ifdef DEBUG
+    assert(the_character);
+#endif // DEBUG
+    std::unordered_map<uint, struct character>::const_iterator it;
+
+    // the styles have no subpixel variants
+    if(style < m_styles.size() && m_style_glyphs[style]){
+        it = m_characters.find(characterKey(code, 0, m_style_glyphs[style]));
+        if(it != m_characters.end()){
+            *the_character = &it->second;
+            return EXIT_SUCCESS;
+        }
+    }
+    return getCharacter(code, phase, the_character);
+}
+
+
+uint FontAtlas::characterKey(uint code, uint phase, uint style){
+    return code | phase << CHARACTER_PHASE_SHIFT | style << CHARACTER_STYLE_SHIFT;
+}
+
+
+uint FontAtlas::phaseWidth(const character& ch) const{
+    return m_lcd ? ch.width * 3 : ch.width;
+}
+
+
+void FontAtlas::setSubpixelPositioning(uint phases, size_t budget){
+#ifdef DEBUG
+    assert(phases >= 1 && phases <= SUBPIXEL_MAX_PHASES);
+#endif // DEBUG
+    m_subpixel_phases = phases;
+    m_subpixel_budget = budget;
+}
+
+
+void FontAtlas::setLcdRendering(bool lcd){
+    m_lcd = lcd;
+    if(m_lcd && m_face){
+        std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+        FT_Library_SetLcdFilter(m_face->glyph->library, FT_LCD_FILTER_DEFAULT);
+    }
+}
+
+
+void FontAtlas::setSdfRendering(bool sdf){
+#ifdef DEBUG
+    assert(!sdf || !m_lcd);
+#endif // DEBUG
+    FT_Int spread = ATLAS_SDF_SPREAD;
+
+    m_sdf = sdf;
+    if(m_sdf && m_face){ // the shaders assume this spread
+        std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+        FT_Property_Set(m_face->glyph->library, "sdf", "spread", &spread);
+    }
+}
+
+
+uint FontAtlas::getSubpixelPhases() const{
+    return m_subpixel_phases;
+}
+
+
+bool FontAtlas::getLcdRendering() const{
+    return m_lcd;
+}
+
+
+bool FontAtlas::getSdfRendering() const{
+    return m_sdf;
 }
 
 
 int FontAtlas::getKerning(uint code1, uint code2) const{
-    // TODO
-    UNUSED(code1);
-    UNUSED(code2);
+    std::unordered_map<uint64_t, int>::const_iterator it;
+
+    it = m_kerning.find((uint64_t)code1 << 32 | code2);
+    if(it == m_kerning.end())
+        return 0;
+    return it->second;
+}
+
+
+void FontAtlas::setPackingMode(int mode){
+#ifdef DEBUG
+    assert(mode == ATLAS_PACK_HEIGHT || mode == ATLAS_PACK_CODE || 
+           mode == ATLAS_PACK_FREQUENCY);
+#endif // DEBUG
+    m_packing_mode = mode;
+}
+
+
+uint FontAtlas::loadKerning(){
+    std::vector<const character*> base;
+    FT_Vector kerning;
+
+    m_kerning.clear();
+    if(!m_face || !FT_HAS_KERNING(m_face))
+        return 0;
+
+    // the pairs are keyed by code point, the phase and style variants would only repeat them
+    for(uint i=0; i<m_characters_vec.size(); i++){
+        if(!is_variant(m_characters_vec[i]))
+            base.push_back(&m_characters_vec[i]);
+    }
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+
+    FT_Activate_Size(m_size);
+    for(uint i=0; i<base.size(); i++){
+        for(uint j=0; j<base.size(); j++){
+            if(FT_Get_Kerning(m_face, base[i]->glyph_index, base[j]->glyph_index,
+                              FT_KERNING_DEFAULT, &kerning))
+                continue;
+            if(kerning.x)
+                m_kerning[(uint64_t)base[i]->code << 32 | base[j]->code] = kerning.x;
+        }
+    }
+    return m_kerning.size();
+}
+
+
+// quadratic curves of an outline in pixels, 6 floats each
+struct outline_context{
+    std::vector<float> curves;
+    float x;
+    float y;
+};
+
+
+static void add_curve(struct outline_context* ctx, float x1, float y1, float x2, float y2){
+    float curve[6] = {ctx->x, ctx->y, x1, y1, x2, y2};
+
+    ctx->curves.insert(ctx->curves.end(), curve, curve + 6);
+    ctx->x = x2;
+    ctx->y = y2;
+}
+
+
+static int outline_move_to(const FT_Vector* to, void* user){
+    struct outline_context* ctx = (struct outline_context*)user;
+
+    ctx->x = to->x / 64.0f;
+    ctx->y = to->y / 64.0f;
+    return 0;
+}
+
+
+static int outline_line_to(const FT_Vector* to, void* user){
+    struct outline_context* ctx = (struct outline_context*)user;
+    float x = to->x / 64.0f, y = to->y / 64.0f;
+
+    add_curve(ctx, (ctx->x + x) * 0.5f, (ctx->y + y) * 0.5f, x, y);
+    return 0;
+}
+
+
+static int outline_conic_to(const FT_Vector* control, const FT_Vector* to, void* user){
+    add_curve((struct outline_context*)user, control->x / 64.0f, control->y / 64.0f,
+              to->x / 64.0f, to->y / 64.0f);
     return 0;
 }
 
 
+// CFF fonts, each quarter of the cubic is approximated by a quadratic
+static int outline_cubic_to(const FT_Vector* control1, const FT_Vector* control2,
+                            const FT_Vector* to, void* user){
+    struct outline_context* ctx = (struct outline_context*)user;
+    float p[4][2] = {{ctx->x, ctx->y}, {control1->x / 64.0f, control1->y / 64.0f},
+                     {control2->x / 64.0f, control2->y / 64.0f}, {to->x / 64.0f, to->y / 64.0f}};
+    float q[4][2];
+
+    for(uint i=0; i < 4; i++){
+        float t0 = i * 0.25f, t1 = t0 + 0.25f;
+        for(uint j=0; j < 2; j++){
+            // the quarter as a cubic, from the derivatives at its ends
+            float a = p[0][j], b = p[1][j], c = p[2][j], d = p[3][j];
+            float s0 = 1.0f - t0, s1 = 1.0f - t1;
+            float e0 = s0*s0*s0*a + 3*s0*s0*t0*b + 3*s0*t0*t0*c + t0*t0*t0*d;
+            float e1 = s1*s1*s1*a + 3*s1*s1*t1*b + 3*s1*t1*t1*c + t1*t1*t1*d;
+            float d0 = 3 * (s0*s0*(b - a) + 2*s0*t0*(c - b) + t0*t0*(d - c)) * 0.25f;
+            float d1 = 3 * (s1*s1*(b - a) + 2*s1*t1*(c - b) + t1*t1*(d - c)) * 0.25f;
+            q[0][j] = e0;
+            q[1][j] = e0 + d0 / 3.0f;
+            q[2][j] = e1 - d1 / 3.0f;
+            q[3][j] = e1;
+        }
+        add_curve(ctx, (3 * (q[1][0] + q[2][0]) - q[0][0] - q[3][0]) * 0.25f,
+                  (3 * (q[1][1] + q[2][1]) - q[0][1] - q[3][1]) * 0.25f, q[3][0], q[3][1]);
+    }
+    return 0;
+}
+
+
+// t of the extremum of a quadratic coordinate, or 0 if it isn't within the curve
+static float curve_extremum(float a, float b, float c){
+    float den = a - 2.0f * b + c, t;
+
+    if(std::fabs(den) < 1e-6f)
+        return 0.0f;
+    t = (a - b) / den;
+    return t > 1e-4f && t < 1.0f - 1e-4f ? t : 0.0f;
+}
+
+
+/* Splits the curves at their x and y extrema, so each one crosses any horizontal or vertical
+ * line at most once. The shader then decides which curves a ray crosses from the endpoints
+ * alone, which is exact for the points shared by consecutive curves. */
+static void split_monotonic(const std::vector<float>& curves, std::vector<float>& monotonic){
+    for(uint i=0; i < curves.size(); i += 6){
+        float c[6], t[2], prev = 0.0f;
+        uint num_t = 0;
+
+        std::copy(curves.begin() + i, curves.begin() + i + 6, c);
+        for(uint axis=0; axis < 2; axis++){
+            float ext = curve_extremum(c[axis], c[axis + 2], c[axis + 4]);
+            if(ext > 0.0f)
+                t[num_t++] = ext;
+        }
+        if(num_t == 2 && t[0] > t[1])
+            std::swap(t[0], t[1]);
+
+        for(uint j=0; j < num_t; j++){
+            float s = (t[j] - prev) / (1.0f - prev), left[6];
+            if(s <= 1e-4f)
+                continue;
+            // de Casteljau, the left part is stored and the right one split again
+            for(uint axis=0; axis < 2; axis++){
+                float q0 = c[axis] + (c[axis + 2] - c[axis]) * s;
+                float q1 = c[axis + 2] + (c[axis + 4] - c[axis + 2]) * s;
+                float m = q0 + (q1 - q0) * s;
+                left[axis] = c[axis];
+                left[axis + 2] = q0;
+                left[axis + 4] = m;
+                c[axis] = m;
+                c[axis + 2] = q1;
+            }
+            monotonic.insert(monotonic.end(), left, left + 6);
+            prev = t[j];
+        }
+        monotonic.insert(monotonic.end(), c, c + 6);
+    }
+}
+
+
+void FontAtlas::clearOutlines(){
+    m_outlines.clear();
+    m_curves.clear();
+}
+
+
+/* m_curves is an RGBA16 (normalized) buffer texture. The first texel of each slot has the
+ * first texel of its curves (low and high 16 bits) and their count, then each curve takes two
+ * texels, (x0, y0, x1, y1) and (x2, y2, 0, 0), in the [0, 1] range of the glyph box. */
+uint FontAtlas::loadOutlines(){
+    uint failed = extractOutlines();
+
+    if(!m_face)
+        return failed;
+    createCurveTexture();
+    m_generation++; // the layouts may use the outlines now
+    updateFingerprint();
+
+    return failed;
+}
+
+
+uint FontAtlas::extractOutlines(){
+    FT_Outline_Funcs funcs;
+    std::vector<std::vector<uint16_t>> glyph_curves;
+    std::vector<float> monotonic;
+    struct outline_context ctx;
+    uint failed = 0, first;
+
+    clearOutlines();
+    if(!m_face)
+        return m_characters_vec.size();
+
+    funcs.move_to = outline_move_to;
+    funcs.line_to = outline_line_to;
+    funcs.conic_to = outline_conic_to;
+    funcs.cubic_to = outline_cubic_to;
+    funcs.shift = 0;
+    funcs.delta = 0;
+
+    std::lock_guard<std::recursive_mutex> lock(FontRegistry::getFaceMutex());
+    FT_Activate_Size(m_size);
+    applyStyle(0);
+    for(uint i=0; i < m_characters_vec.size(); i++){
+        const struct character& ch = m_characters_vec[i];
+        struct glyph_outline outline;
+
+        if(ch.phase || ch.style || m_outlines.count(ch.code))
+            continue;
+        ctx.curves.clear();
+        monotonic.clear();
+        if(m_outlines.size() == OUTLINE_MAX_SLOTS ||
+           FT_Load_Glyph(m_face, ch.glyph_index, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP) ||
+           m_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE ||
+           FT_Outline_Decompose(&m_face->glyph->outline, &funcs, &ctx) ||
+           ctx.curves.empty()){
+            failed++;
+            continue;
+        }
+        split_monotonic(ctx.curves, monotonic);
+
+        outline.box[0] = outline.box[1] = INFINITY;
+        outline.box[2] = outline.box[3] = -INFINITY;
+        for(uint j=0; j < monotonic.size(); j += 2){
+            outline.box[0] = std::min(outline.box[0], monotonic[j]);
+            outline.box[1] = std::min(outline.box[1], monotonic[j + 1]);
+            outline.box[2] = std::max(outline.box[2], monotonic[j]);
+            outline.box[3] = std::max(outline.box[3], monotonic[j + 1]);
+        }
+        if(outline.box[2] <= outline.box[0] || outline.box[3] <= outline.box[1] ||
+           monotonic.size() / 6 > 0xffff){
+            failed++;
+            continue;
+        }
+
+        glyph_curves.push_back(std::vector<uint16_t>());
+        std::vector<uint16_t>& quantized = glyph_curves.back();
+        for(uint j=0; j < monotonic.size(); j += 6){
+            for(uint k=0; k < 6; k += 2){
+                quantized.push_back((monotonic[j + k] - outline.box[0]) /
+                                    (outline.box[2] - outline.box[0]) * 65535.0f + 0.5f);
+                quantized.push_back((monotonic[j + k + 1] - outline.box[1]) /
+                                    (outline.box[3] - outline.box[1]) * 65535.0f + 0.5f);
+            }
+            quantized.push_back(0);
+            quantized.push_back(0);
+        }
+        outline.slot = m_outlines.size();
+        m_outlines[ch.code] = outline;
+    }
+
+    // slot headers first, then the curves
+    first = glyph_curves.size();
+    m_curves.resize(glyph_curves.size() * 4);
+    for(uint i=0; i < glyph_curves.size(); i++){
+        m_curves[i * 4] = first & 0xffff;
+        m_curves[i * 4 + 1] = first >> 16;
+        m_curves[i * 4 + 2] = glyph_curves[i].size() / 8;
+        m_curves[i * 4 + 3] = 0;
+        m_curves.insert(m_curves.end(), glyph_curves[i].begin(), glyph_curves[i].end());
+        first += glyph_curves[i].size() / 4;
+    }
+
+    return failed;
+}
+
+
+void FontAtlas::createCurveTexture(){
+#ifndef PTT_NO_GL
+    GLint max_texels;
+
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    if(m_curves.size() / 4 > (size_t)max_texels)
+        std::cerr << "FontAtlas::createCurveTexture: " << m_curves.size() / 4 << " texels, "
+                  << "the limit is " << max_texels << std::endl;
+
+    if(!m_curve_buffer){
+        glGenBuffers(1, &m_curve_buffer);
+        glGenTextures(1, &m_curve_texture);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, m_curve_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_curves.size() * sizeof(uint16_t), m_curves.data(),
+                 GL_STATIC_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, m_curve_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA16, m_curve_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+#endif // PTT_NO_GL
+}
+
+
+const struct glyph_outline* FontAtlas::getOutline(uint code) const{
+    std::unordered_map<uint, struct glyph_outline>::const_iterator it = m_outlines.find(code);
+
+    return it == m_outlines.end() ? nullptr : &it->second;
+}
+
+
+const uint16_t* FontAtlas::getCurves() const{
+    return m_curves.empty() ? nullptr : m_curves.data();
+}
+
+
+uint FontAtlas::saveAtlas(const char* path) const{
+#ifdef DEBUG
+    assert(path);
+#endif // DEBUG
+    struct atlas_file_header header;
+    struct kerning_pair pair;
+    std::ofstream file;
+
+    if(!m_atlas)
+        return EXIT_FAILURE;
+
+    file.open(path, std::ios::binary);
+    if(!file.is_open()){
+        std::cerr << "FontAtlas::saveAtlas: failed to open " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    header.magic = ATLAS_FILE_MAGIC;
+    header.version = ATLAS_FILE_VERSION;
+    header.atlas_size = m_atlas_size;
+    header.font_height = m_font_height;
+    header.ascender = m_ascender;
+    header.num_characters = m_characters_vec.size();
+    header.num_kerning_pairs = m_kerning.size();
+    header.subpixel_phases = m_subpixel_phases;
+    header.lcd = m_lcd;
+    header.sdf = m_sdf;
+    header.num_styles = m_styles.size();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(m_characters_vec.data()),
+               m_characters_vec.size() * sizeof(struct character));
+    for(std::unordered_map<uint64_t, int>::const_iterator it=m_kerning.begin();
+        it != m_kerning.end(); ++it){
+        pair.code1 = it->first >> 32;
+        pair.code2 = it->first & 0xFFFFFFFF;
+        pair.kerning = it->second;
+        file.write(reinterpret_cast<const char*>(&pair), sizeof(pair));
+    }
+    file.write(reinterpret_cast<const char*>(m_styles.data()),
+               m_styles.size() * sizeof(struct font_style));
+    file.write(reinterpret_cast<const char*>(m_atlas.get()), m_atlas_size * m_atlas_size);
+
+    return file.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+uint FontAtlas::loadAtlas(const char* path){
+#ifdef DEBUG
+    assert(path);
+#endif // DEBUG
+    struct atlas_file_header header;
+    struct kerning_pair pair;
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    std::vector<struct character> characters;
+    std::unordered_map<uint64_t, int> kerning;
+    std::vector<struct font_style> styles;
+    std::unique_ptr<unsigned char[]> atlas;
+    uint64_t file_size, expected_size;
+    size_t pixels;
+    bool valid;
+
+    if(!file.is_open()){
+        std::cerr << "FontAtlas::loadAtlas: failed to open " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    file_size = file.tellg();
+    file.seekg(0);
+
+    // the counts are checked against the size of the file before anything is allocated
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    expected_size = sizeof(header) +
+                    (uint64_t)header.num_characters * sizeof(struct character) +
+                    (uint64_t)header.num_kerning_pairs * sizeof(struct kerning_pair) +
+                    (uint64_t)header.num_styles * sizeof(struct font_style) +
+                    (uint64_t)header.atlas_size * header.atlas_size;
+    if(!file.good() || header.magic != ATLAS_FILE_MAGIC || 
+       header.version != ATLAS_FILE_VERSION || !header.atlas_size ||
+       (header.atlas_size & (header.atlas_size - 1)) ||
+       header.atlas_size > ATLAS_FILE_MAX_SIZE || !header.num_styles ||
+       header.num_styles > FONT_MAX_STYLES || !header.subpixel_phases ||
+       header.subpixel_phases > SUBPIXEL_MAX_PHASES){
+        std::cerr << "FontAtlas::loadAtlas: " << path << " is not a valid atlas file" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(file_size != expected_size){
+        std::cerr << "FontAtlas::loadAtlas: " << path << (file_size < expected_size ?
+                     " is truncated" : " is not a valid atlas file") << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    characters.resize(header.num_characters);
+    file.read(reinterpret_cast<char*>(characters.data()),
+              header.num_characters * sizeof(struct character));
+    for(uint i=0; i<header.num_kerning_pairs && file.good(); i++){
+        file.read(reinterpret_cast<char*>(&pair), sizeof(pair));
+        kerning[(uint64_t)pair.code1 << 32 | pair.code2] = pair.kerning;
+    }
+    styles.resize(header.num_styles);
+    file.read(reinterpret_cast<char*>(styles.data()),
+              header.num_styles * sizeof(struct font_style));
+    pixels = (size_t)header.atlas_size * header.atlas_size;
+    atlas.reset(new unsigned char[pixels]);
+    file.read(reinterpret_cast<char*>(atlas.get()), pixels);
+    if(!file.good()){
+        std::cerr << "FontAtlas::loadAtlas: " << path << " is truncated" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    valid = std::all_of(styles.begin(), styles.end(), is_valid_style);
+    for(uint i=0; i < characters.size() && valid; i++){
+        const struct character& ch = characters[i];
+        valid = ch.style < header.num_styles && ch.phase < header.subpixel_phases &&
+                ch.tex_x_min >= 0.0f && ch.tex_x_max <= 1.0f && ch.tex_x_min <= ch.tex_x_max &&
+                ch.tex_y_min >= 0.0f && ch.tex_y_max <= 1.0f && ch.tex_y_min <= ch.tex_y_max;
+    }
+    if(!valid){
+        std::cerr << "FontAtlas::loadAtlas: " << path << " is not a valid atlas file" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    clearOutlines(); // may come from another font
+    m_atlas_size = header.atlas_size;
+    m_font_height = header.font_height;
+    m_ascender = header.ascender;
+    m_subpixel_phases = header.subpixel_phases;
+    m_lcd = header.lcd;
+    m_sdf = header.sdf;
+    m_characters_vec.swap(characters);
+    m_kerning.swap(kerning);
+    m_styles.swap(styles);
+    m_atlas.swap(atlas);
+    m_style_glyphs.clear();
+    for(uint i=0; i < m_styles.size(); i++)
+        m_style_glyphs.push_back(styleGlyphs(i));
+
+    m_characters.clear();
+    for(uint i=0; i<m_characters_vec.size(); i++)
+        m_characters[characterKey(m_characters_vec[i].code, m_characters_vec[i].phase,
+                                  m_characters_vec[i].style)] = m_characters_vec[i];
+    m_metrics_cache.clear();
+    m_generation++;
+    updateFingerprint();
+
+    createTexture();
+
+    return EXIT_SUCCESS;
+}
+
+
+uint FontAtlas::getCharacterCount() const{
+    return m_characters_vec.size();
+}
+
+
+uint FontAtlas::getKerningCount() const{
+    return m_kerning.size();
+}
+
+
+void FontAtlas::computeMetrics(const wchar_t* text, float scale, uint style,
+                               struct text_metrics& metrics) const{
+    const character* ch;
+    float w = 0.0f, max_w = 0.0f;
+
+    metrics.lines = 1;
+    metrics.missing = 0;
+    metrics.advances.clear();
+
+    for(uint i=0; text[i] != '\0'; i++){
+        if(text[i] == '\n'){
+            metrics.advances.push_back(0.0f);
+            metrics.lines++;
+            max_w = std::max(max_w, w);
+            w = 0.0f;
+            continue;
+        }
+        if(getCharacter(text[i], 0, style, &ch) == EXIT_FAILURE)
+            metrics.missing++;
+
+        if(m_subpixel_phases > 1)
+            metrics.advances.push_back((float)ch->advance_x / 64.0f * scale);
+        else
+            metrics.advances.push_back((float)(ch->advance_x >> 6) * scale);
+        w += metrics.advances.back();
+    }
+
+    metrics.width = std::max(max_w, w);
+    metrics.height = (m_font_height >> 6) * scale * metrics.lines;
+}
+
+
+void FontAtlas::measure(const wchar_t* text, float scale, const text_metrics** metrics,
+                        uint style) const{
+#ifdef DEBUG
+    assert(text);
+    assert(metrics);
+#endif // DEBUG
+    size_t hash = 14695981039346656037ULL; // FNV-1a over the characters, the scale and the style
+    uint len = 0, scale_bits;
+
+    while(text[len] != '\0'){
+        hash = (hash ^ (size_t)text[len]) * 1099511628211ULL;
+        len++;
+    }
+    std::memcpy(&scale_bits, &scale, sizeof(scale_bits));
+    hash = (hash ^ scale_bits) * 1099511628211ULL;
+    hash = (hash ^ style) * 1099511628211ULL;
+
+    std::unordered_map<size_t, struct metrics_entry>::iterator it = m_metrics_cache.find(hash);
+    if(it != m_metrics_cache.end() && it->second.scale == scale && it->second.style == style &&
+       it->second.text.compare(0, std::wstring::npos, text, len) == 0){
+        *metrics = &it->second.metrics;
+        return;
+    }
+
+    if(m_metrics_cache.size() >= METRICS_CACHE_MAX)
+        m_metrics_cache.clear();
+
+    struct metrics_entry& entry = m_metrics_cache[hash]; // overwrites on hash collision
+    entry.text.assign(text, len);
+    entry.scale = scale;
+    entry.style = style;
+    computeMetrics(text, scale, style, entry.metrics);
+
+    *metrics = &entry.metrics;
+}
+
+
+void FontAtlas::measure(const wchar_t* text, float scale, struct text_metrics& metrics,
+                        uint style) const{
+#ifdef DEBUG
+    assert(text);
+#endif // DEBUG
+    computeMetrics(text, scale, style, metrics);
+}
+
+
+void FontAtlas::clearMetricsCache(){
+    m_metrics_cache.clear();
+}
+
+
+bool FontAtlas::rebake(const char* path, int size){
+#ifdef DEBUG
+    assert(size > 0);
+#endif // DEBUG
+    std::vector<uint> codes;
+    std::string font_path = path ? path : m_font_path;
+    bool kerning = !m_kerning.empty(), outlines = !m_outlines.empty();
+
+    if(m_rebake_thread.joinable() || font_path.empty())
+        return false;
+
+    m_rebaked.reset(new FontAtlas(m_atlas_size));
+    FontAtlas* atlas = m_rebaked.get();
+    atlas->m_packing_mode = m_packing_mode;
+    atlas->m_texture_options = m_texture_options;
+    atlas->m_subpixel_phases = m_subpixel_phases;
+    atlas->m_subpixel_budget = m_subpixel_budget;
+    atlas->m_lcd = m_lcd; // the library options are already set by this atlas
+    atlas->m_sdf = m_sdf;
+    atlas->m_frequencies = m_frequencies;
+    atlas->m_styles = m_styles; // baked again by createAtlas
+    atlas->m_style_glyphs = m_style_glyphs;
+    atlas->m_font_path = font_path; // for the error message if it doesn't load
+    for(uint i=0; i < m_characters_vec.size(); i++)
+        if(!is_variant(m_characters_vec[i]) && m_characters_vec[i].code) // 0 comes with the font
+            codes.push_back(m_characters_vec[i].code);
+    std::sort(codes.begin(), codes.end()); // the atlas has them in packing order
+
+    m_rebake_done = false;
+    m_rebake_failed = false;
+    m_rebake_thread = std::thread([this, atlas, codes, font_path, size, kerning, outlines](){
+        bool failed;
+
+        if(!atlas->loadFont(font_path.c_str(), size)){
+            for(uint i=0; i < codes.size(); i++)
+                atlas->loadCharacter(codes[i]);
+            // in the order they were loaded, so it packs like createAtlas would
+            std::vector<struct character> loaded = atlas->m_characters_vec;
+            while((failed = atlas->bakeAtlas()) && atlas->m_atlas_size < ATLAS_REBAKE_MAX_SIZE){
+                atlas->m_atlas_size *= 2;
+                atlas->m_characters_vec = loaded;
+            }
+            m_rebake_failed = failed; // swapRebaked keeps the old glyphs
+            if(kerning && !failed)
+                atlas->loadKerning();
+            if(outlines && !failed)
+                atlas->extractOutlines();
+        }
+        m_rebake_done = true;
+    });
+
+    return true;
+}
+
+
+bool FontAtlas::swapRebaked(){
+    if(!m_rebake_thread.joinable() || !m_rebake_done)
+        return false;
+    m_rebake_thread.join();
+
+    FontAtlas& atlas = *m_rebaked;
+    if(!atlas.m_face){
+        std::cerr << "FontAtlas::swapRebaked: failed to load " << atlas.m_font_path
+                  << std::endl;
+        m_rebaked.reset(nullptr);
+        return false;
+    }
+    if(m_rebake_failed){
+        std::cerr << "FontAtlas::swapRebaked: the glyphs of " << atlas.m_font_path << " at "
+                  << atlas.m_font_size << " px don't fit in a " << ATLAS_REBAKE_MAX_SIZE
+                  << " atlas" << std::endl;
+        m_rebaked.reset(nullptr);
+        return false;
+    }
+
+    // the old face and size go away with the other atlas
+    std::swap(m_face, atlas.m_face);
+    std::swap(m_size, atlas.m_size);
+    m_font_path.swap(atlas.m_font_path);
+    m_font_size = atlas.m_font_size;
+    m_font_height = atlas.m_font_height;
+    m_ascender = atlas.m_ascender;
+    m_atlas_size = atlas.m_atlas_size;
+    m_atlas.swap(atlas.m_atlas);
+    m_characters.swap(atlas.m_characters);
+    m_characters_vec.swap(atlas.m_characters_vec);
+    m_kerning.swap(atlas.m_kerning);
+    m_outlines.swap(atlas.m_outlines);
+    m_curves.swap(atlas.m_curves);
+    m_rebaked.reset(nullptr);
+
+    createTexture();
+    if(m_curve_buffer || !m_curves.empty())
+        createCurveTexture();
+    m_metrics_cache.clear();
+    m_generation++;
+    updateFingerprint();
+
+    return true;
+}
+
+
+bool FontAtlas::isRebaking() const{
+    return m_rebake_thread.joinable();
+}
+
+
+int FontAtlas::getFontSize() const{
+    return m_font_size;
+}
+
+
+uint FontAtlas::getGeneration() const{
+    return m_generation;
+}
+
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size){
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for(size_t i=0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL; // FNV-1a
+    return hash;
+}
+
+
+void FontAtlas::updateFingerprint(){
+    uint options[6] = {m_atlas_size, (uint)m_font_height, (uint)m_ascender, m_subpixel_phases,
+                       m_lcd, m_sdf};
+    uint64_t hash = hash_bytes(14695981039346656037ULL, options, sizeof(options));
+
+    // the characters are plain ints and floats, no padding
+    hash = hash_bytes(hash, m_characters_vec.data(),
+                      m_characters_vec.size() * sizeof(struct character));
+    for(uint i=0; i < m_characters_vec.size(); i++){
+        const struct glyph_outline* outline = getOutline(m_characters_vec[i].code);
+        if(outline && !is_variant(m_characters_vec[i]))
+            hash = hash_bytes(hash, outline, sizeof(struct glyph_outline));
+    }
+    // the oblique shear is part of the layout
+    hash = hash_bytes(hash, m_styles.data(), m_styles.size() * sizeof(struct font_style));
+    hash = hash_bytes(hash, m_curves.data(), m_curves.size() * sizeof(uint16_t));
+    m_fingerprint = hash ? hash : 1;
+}
+
+
+uint64_t FontAtlas::getFingerprint() const{
+    return m_fingerprint;
+}
+
+
 const unsigned char* FontAtlas::getAtlas() const{
     return m_atlas.get();
 }
@@ -250,20 +1461,177 @@ int FontAtlas::getHeight() const{
 }
 
 
+int FontAtlas::getAscender() const{
+    return m_ascender;
+}
+
+
 void FontAtlas::createTexture(){
+#ifndef PTT_NO_GL
+    GLenum internal_format = GL_RED;
+    std::unique_ptr<unsigned char[]> mip;
+    const unsigned char* pixels = m_atlas.get();
+    uint size = m_atlas_size, level = 0;
+    GLint compressed, bytes;
+
+    if(m_texture_options & ATLAS_TEXTURE_COMPRESSED)
+        internal_format = GL_COMPRESSED_RED_RGTC1; // the driver compresses on upload
+
+    glDeleteTextures(1, &m_texture_id);
     glGenTextures(1, &m_texture_id);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_texture_id);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, m_atlas_size, m_atlas_size, 0, GL_RED, GL_UNSIGNED_BYTE, m_atlas.get());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    m_gpu_bytes = 0;
+    while(true){
+        glTexImage2D(GL_TEXTURE_2D, level, internal_format, size, size, 0, GL_RED,
+                     GL_UNSIGNED_BYTE, pixels);
+
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+        if(compressed)
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE,
+                                     &bytes);
+        else
+            bytes = size * size;
+        m_gpu_bytes += bytes;
+
+        // the glyphs are ATLAS_PADDING pixels apart, smaller levels would blend them together
+        if(!(m_texture_options & ATLAS_TEXTURE_MIPMAPS) || (2u << level) > ATLAS_PADDING ||
+           size == 1)
+            break;
+
+        // box filter
+        size /= 2;
+        level++;
+        std::unique_ptr<unsigned char[]> next(new unsigned char[size * size]);
+        for(uint y=0; y<size; y++){
+            for(uint x=0; x<size; x++){
+                const unsigned char* p = pixels + (y * 2) * (size * 2) + x * 2;
+                next[y * size + x] = (p[0] + p[1] + p[size * 2] + p[size * 2 + 1] + 2) / 4;
+            }
+        }
+        mip.swap(next);
+        pixels = mip.get();
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level);
+    if(level)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    else
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    if(m_texture_options & ATLAS_TEXTURE_DROP_CPU_COPY)
+        m_atlas.reset(nullptr);
+#endif // PTT_NO_GL
+}
+
+
+void FontAtlas::setTextureOptions(int options){
+    m_texture_options = options;
+}
+
+
+void FontAtlas::getMemoryReport(struct atlas_memory_report& report) const{
+    report.cpu_bytes = m_atlas ? m_atlas_size * m_atlas_size : 0;
+    report.gpu_bytes = m_gpu_bytes;
+    report.table_bytes = m_characters_vec.size() * sizeof(struct character) +
+                         m_characters.size() * (sizeof(struct character) + sizeof(int)) +
+                         m_kerning.size() * (sizeof(uint64_t) + sizeof(int)) +
+                         m_outlines.size() * (sizeof(struct glyph_outline) + sizeof(uint));
+    report.curve_bytes = m_curves.size() * sizeof(uint16_t);
+}
+
+
+void FontAtlas::getStats(struct atlas_stats& stats) const{
+    float rows_end = 0.0f, area = 0.0f;
+
+    // taken from the texture coordinates so it also works with baked atlases
+    for(std::unordered_map<uint, struct character>::const_iterator it = m_characters.begin();
+        it != m_characters.end(); ++it){
+        rows_end = std::max(rows_end, it->second.tex_y_max);
+        area += (it->second.tex_x_max - it->second.tex_x_min) *
+                (it->second.tex_y_max - it->second.tex_y_min);
+    }
+    stats.characters = m_characters.size();
+    stats.occupancy = rows_end;
+    stats.coverage = area;
+#ifdef PTT_PROFILE
+    stats.fallback_hits = m_fallback_hits;
+#else
+    stats.fallback_hits = 0;
+#endif // PTT_PROFILE
+}
+
+
+void FontAtlas::resetStats(){
+#ifdef PTT_PROFILE
+    m_fallback_hits = 0;
+#endif // PTT_PROFILE
+}
+
+
+GLuint FontAtlas::getGlyphBuffer(uint& num_glyphs) const{
+#ifndef PTT_NO_GL
+    if(m_glyph_buffer && m_glyph_buffer_generation == m_generation){
+        num_glyphs = m_num_gpu_glyphs;
+        return m_glyph_buffer;
+    }
+
+    std::vector<struct gpu_glyph> glyphs;
+    glyphs.reserve(m_characters_vec.size());
+    for(uint i=0; i < m_characters_vec.size(); i++){
+        const struct character& ch = m_characters_vec[i];
+        struct gpu_glyph glyph = {};
+
+        if(is_variant(ch))
+            continue;
+        glyph.tex[0] = ch.tex_x_min;
+        glyph.tex[1] = ch.tex_x_max;
+        glyph.tex[2] = ch.tex_y_min;
+        glyph.tex[3] = ch.tex_y_max;
+        glyph.code = ch.code;
+        glyph.bearing_x = ch.bearing_x;
+        glyph.bearing_y = ch.bearing_y;
+        glyph.width = ch.width;
+        glyph.height = ch.height;
+        glyph.advance = ch.advance_x >> 6;
+        glyphs.push_back(glyph);
+    }
+    // the shaders binary search the codes
+    std::sort(glyphs.begin(), glyphs.end(),
+              [](const struct gpu_glyph& a, const struct gpu_glyph& b){return a.code < b.code;});
+
+    if(!m_glyph_buffer)
+        glGenBuffers(1, &m_glyph_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_glyph_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, glyphs.size() * sizeof(struct gpu_glyph),
+                 glyphs.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    m_num_gpu_glyphs = glyphs.size();
+    m_glyph_buffer_generation = m_generation;
+
+    num_glyphs = m_num_gpu_glyphs;
+    return m_glyph_buffer;
+#else
+    num_glyphs = 0;
+    return 0;
+#endif // PTT_NO_GL
 }
 
 
 void FontAtlas::bindTexture() const{
+#ifndef PTT_NO_GL
+    if(m_curve_texture && !m_curves.empty()){
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, m_curve_texture);
+    }
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_texture_id);
+#endif // PTT_NO_GL
 }
 
@@ -20,15 +20,30 @@
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_SIZES_H
+#include FT_OUTLINE_H
+#include FT_LCD_FILTER_H
+#include FT_MODULE_H
+#include FT_MULTIPLE_MASTERS_H
 
 #include <vector>
+#include <cstdint>
 #include <unordered_map>
 #include <memory>
+#include <string>
+#include <atomic>
+#include <thread>
+
+#ifdef PTT_NO_GL
+typedef unsigned int GLuint;
+#endif // PTT_NO_GL
 
 
 struct character{
     uint code; // unicode value
     uint glyph_index; // freetype index
+    uint phase; // subpixel offset in 1/phases of a pixel, 0 for the normal glyph
+    uint style; // see FontAtlas::addStyle, 0 for the font as loaded
 
     int width;        //size x
     int height;       //size y 
@@ -45,20 +60,207 @@ struct character{
 };
 
 
+struct text_metrics{
+    uint width;
+    uint height;
+    uint lines;
+    uint missing; // characters not in the atlas
+    std::vector<float> advances; // one per character, 0 for the line breaks
+};
+
+
+// maximum number of measured strings kept by each atlas, the cache is flushed when full
+#define METRICS_CACHE_MAX 4096
+
+// order in which the characters are placed in the atlas
+#define ATLAS_PACK_HEIGHT 1 // tallest first, wastes less space
+#define ATLAS_PACK_CODE 2 // by code point, keeps ranges together
+#define ATLAS_PACK_FREQUENCY 3 // most used first (see loadCorpus), keeps them close in memory
+
+// subpixel phases and styles are stored in the key of the character map next to the code point
+#define CHARACTER_PHASE_SHIFT 21
+#define SUBPIXEL_MAX_PHASES 4
+#define CHARACTER_STYLE_SHIFT 24
+
+// style variants baked in the same atlas (see FontAtlas::addStyle), the first one is the font
+#define FONT_MAX_STYLES 8
+#define FONT_STYLE_MAX_AXES 4
+
+/* Instance of a variable font plus synthetic bold and oblique. The styles with the same axes
+ * and emboldening share their glyphs, so an oblique style alone bakes nothing: Text2D shears
+ * the quads of the normal glyphs. */
+struct font_style{
+    float axes[FONT_STYLE_MAX_AXES]; // design coordinates, in the order of getVariationAxes
+    uint num_axes; // the axes after these keep their default, 0 for the default instance
+    float embolden; // pixels the glyphs grow in width and height (FT_Outline_EmboldenXY)
+    float oblique; // horizontal shear from the baseline, 0.2 is about 11 degrees
+};
+
+struct font_axis{
+    uint tag; // FT_MAKE_TAG('w', 'g', 'h', 't')...
+    float min;
+    float def;
+    float max;
+};
+
+// the re-baked atlases (see FontAtlas::rebake) grow up to this size when the glyphs don't fit
+#define ATLAS_REBAKE_MAX_SIZE 4096
+
+// space between the glyphs in the atlas
+#define ATLAS_PADDING 2
+
+// distance field atlases (see setSdfRendering), in pixels at the font size on each side of the edge
+#define ATLAS_SDF_SPREAD 8
+
+// texture options (see setTextureOptions)
+#define ATLAS_TEXTURE_DROP_CPU_COPY 1 // the pixels are freed after the upload
+#define ATLAS_TEXTURE_COMPRESSED 2 // RGTC1/BC4, half the size of the 8 bit texture
+#define ATLAS_TEXTURE_MIPMAPS 4 // as many levels as the padding allows
+
+struct atlas_memory_report{
+    size_t cpu_bytes; // pixels kept in memory
+    size_t gpu_bytes; // texture size, all levels
+    size_t table_bytes; // approximate size of the character and kerning tables
+    size_t curve_bytes; // outlines, the same in memory and in the GPU (see loadOutlines)
+};
+
+struct atlas_stats{
+    uint characters; // phase variants included
+    float occupancy; // fraction of the atlas height used by the rows
+    float coverage; // fraction of the atlas area covered by glyphs
+    size_t fallback_hits; // lookups that returned the null character, needs PTT_PROFILE
+};
+
+/* Outline glyphs (see loadOutlines) get a cell of OUTLINE_CELL x OUTLINE_CELL in texture space,
+ * with their slot in the integer part, so they share the vertex format with the atlas glyphs
+ * (texture coordinates from 0 to 1). The glyph box goes from 1.5 to 2.5 within the cell. */
+#define OUTLINE_CELL 4.0f
+#define OUTLINE_SLOTS_X 255
+#define OUTLINE_MAX_SLOTS (OUTLINE_SLOTS_X * 256)
+
+struct glyph_outline{
+    uint slot;
+    float box[4]; // x min, y min, x max, y max in pixels at the font size, from the pen
+};
+
+// baked atlas files (see saveAtlas)
+#define ATLAS_FILE_MAGIC 0x31545450 // "PTT1"
+#define ATLAS_FILE_VERSION 5
+#define ATLAS_FILE_MAX_SIZE 16384 // largest atlas loadAtlas accepts, the usual GL texture limit
+
+struct atlas_file_header{
+    uint magic;
+    uint version;
+    uint atlas_size;
+    int font_height;
+    int ascender;
+    uint num_characters;
+    uint num_kerning_pairs;
+    uint subpixel_phases;
+    uint lcd;
+    uint sdf;
+    uint num_styles; // the font_style table goes after the kerning pairs
+};
+
+/* Compares the characters baked from a corpus with the ones that would be baked by loading
+ * the whole unicode pages (256 code points) the corpus touches. */
+struct subset_report{
+    uint glyphs;
+    uint baseline_glyphs;
+    size_t bytes; // atlas area used by the glyphs, padding included
+    size_t baseline_bytes; // estimated from the glyph metrics
+};
+
+/* Entry of the glyph table of the compute shaders (see getGlyphBuffer), in std430 layout:
+ * struct glyph{ vec4 tex; uint code; int bearing_x, bearing_y, width, height, advance; }
+ * with two more uints of padding. */
+struct gpu_glyph{
+    float tex[4]; // x min, x max, y min, y max
+    uint code;
+    int bearing_x;
+    int bearing_y;
+    int width;
+    int height;
+    int advance; // whole pixels
+    uint padding[2];
+};
+
+struct kerning_pair{
+    uint code1;
+    uint code2;
+    int kerning;
+};
+
+
 class FontAtlas{
     private:
-        FT_Library m_ft;
-        FT_Face m_face;
+        FT_Face m_face; // shared with other atlases, owned by the FontRegistry
+        FT_Size m_size;
+        std::string m_font_path;
+        int m_font_size;
 
         uint m_atlas_size;
         int m_font_height;
+        int m_ascender;
         std::unique_ptr<unsigned char[]> m_atlas;
-        std::unordered_map<int, struct character> m_characters;
+        std::unordered_map<uint, struct character> m_characters; // see characterKey
         std::vector<struct character> m_characters_vec;
+        std::unordered_map<uint64_t, int> m_kerning;
+        std::unordered_map<uint, uint> m_frequencies; // code point counts from the corpora
+        int m_packing_mode;
+        int m_texture_options;
+        size_t m_gpu_bytes;
+        uint m_subpixel_phases;
+        size_t m_subpixel_budget;
+        bool m_lcd;
+        bool m_sdf;
+        uint m_generation;
+        uint64_t m_fingerprint;
+        std::vector<struct font_style> m_styles; // the first one is the font as loaded
+        std::vector<uint> m_style_glyphs; // style whose glyphs each style is drawn with
 
         GLuint m_texture_id;
 
+        std::unordered_map<uint, struct glyph_outline> m_outlines; // by code point
+        std::vector<uint16_t> m_curves; // see loadOutlines
+        GLuint m_curve_buffer, m_curve_texture;
+        mutable GLuint m_glyph_buffer; // see getGlyphBuffer
+        mutable uint m_glyph_buffer_generation, m_num_gpu_glyphs;
+
+        struct metrics_entry{
+            std::wstring text;
+            float scale;
+            uint style;
+            struct text_metrics metrics;
+        };
+        mutable std::unordered_map<size_t, struct metrics_entry> m_metrics_cache;
+
+        // see rebake, the worker only touches the new atlas until m_rebake_done is set
+        std::unique_ptr<FontAtlas> m_rebaked;
+        std::thread m_rebake_thread;
+        std::atomic<bool> m_rebake_done;
+        std::atomic<bool> m_rebake_failed; // the glyphs didn't fit in the largest atlas
+#ifdef PTT_PROFILE
+        mutable std::atomic<size_t> m_fallback_hits; // lookups can come from several threads
+#endif // PTT_PROFILE
+
         void createTexture();
+        void createCurveTexture();
+        bool bakeAtlas(); // createAtlas without the texture
+        uint extractOutlines(); // loadOutlines without the texture
+        void clearOutlines();
+        void updateFingerprint();
+        uint renderGlyph(uint glyph_index, uint phase, uint style);
+        void addCharacter(uint code, uint glyph_index, uint phase, uint style);
+        void loadPhaseVariants();
+        void loadStyleVariants();
+        // the variable font instance of the style, the face is shared so it's set before loading
+        void applyStyle(uint style);
+        uint styleGlyphs(uint style) const; // the first style with the same glyphs
+        uint phaseWidth(const character& ch) const; // width in the atlas
+        static uint characterKey(uint code, uint phase, uint style);
+        void computeMetrics(const wchar_t* text, float scale, uint style,
+                            struct text_metrics& metrics) const;
     public:
         FontAtlas();
         FontAtlas(uint atlas_size);
@@ -67,16 +269,102 @@ class FontAtlas{
 
         uint loadCharacterRange(uint start, uint end);
         uint loadCharacter(uint code);
+        // loads only the characters used by the text and counts how often they appear
+        uint loadCorpus(const wchar_t* text);
+        uint loadCorpusFile(const char* path); // UTF-8 file
+        void getSubsetReport(struct subset_report& report);
         bool createAtlas(bool save_png);
+        void setPackingMode(int mode);
+        /* Bakes phases - 1 extra variants of each character rendered at fractions of a pixel,
+         * picked by Text2D from the fractional pen position. The variants take at most
+         * budget bytes of the atlas, the characters of the corpus (if any) go first. */
+        void setSubpixelPositioning(uint phases, size_t budget);
+        /* Adds a style baked by the next createAtlas, with every character loaded for the font
+         * (not the subpixel variants). Characters the style has no glyph for are drawn with
+         * the normal ones. Returns its index for Text2D::setStringStyle, or 0 (the font as
+         * loaded) if there are FONT_MAX_STYLES already. The axes are ignored if the font
+         * isn't a variable font. */
+        uint addStyle(const struct font_style& style);
+        const struct font_style* getStyle(uint style) const; // nullptr if there's none
+        uint getStyleCount() const; // the font as loaded included
+        // axes of a variable font, returns how many there are (0 for the other fonts)
+        uint getVariationAxes(std::vector<struct font_axis>& axes) const;
+        // horizontal RGB subpixel coverage, needs a dual source blending shader
+        void setLcdRendering(bool lcd);
+        /* Bakes signed distance fields instead of coverage, the glyphs grow by ATLAS_SDF_SPREAD
+         * on each side. Needs a shader that reads them (get_effects_program in the example),
+         * which is also the one that draws the string effects (see Text2D::setStringEffect).
+         * Call it before loading the characters, not compatible with LCD rendering. */
+        void setSdfRendering(bool sdf);
+        uint getSubpixelPhases() const;
+        bool getLcdRendering() const;
+        bool getSdfRendering() const;
+        // combination of ATLAS_TEXTURE_* flags, used by createAtlas and loadAtlas
+        void setTextureOptions(int options);
+        void getMemoryReport(struct atlas_memory_report& report) const;
+        void getStats(struct atlas_stats& stats) const;
+        void resetStats();
+        // reads the kerning of every pair of loaded characters, call after createAtlas
+        uint loadKerning();
+        /* Extracts the outlines of the loaded characters into a curve buffer, so the glyphs
+         * drawn at large scales (see Text2D::setOutlineScale) stay sharp without baking
+         * bigger ones. Needs the font, so it isn't available with baked atlases, and a shader
+         * that handles both kinds of glyphs (get_outline_program in the example). Returns
+         * the number of characters left without outline. */
+        uint loadOutlines();
+        const struct glyph_outline* getOutline(uint code) const; // nullptr if there's none
+        const uint16_t* getCurves() const; // nullptr without outlines
+
+        /* Baked atlases hold the pixels, the glyph table and the kerning pairs. Loading one
+         * doesn't need a font and creates the texture right away. */
+        uint saveAtlas(const char* path) const;
+        uint loadAtlas(const char* path);
 
         int getCharacter(uint code, const character** the_character) const;
+        int getCharacter(uint code, uint phase, const character** the_character) const;
+        // the glyph of a style, the normal one if the style doesn't have it
+        int getCharacter(uint code, uint phase, uint style, const character** the_character) const;
         int getKerning(uint code1, uint code2) const;
+        uint getCharacterCount() const;
+        uint getKerningCount() const;
         uint getAtlasSize() const;
         int getHeight() const;
+        int getAscender() const;
         const unsigned char* getAtlas() const;
         void bindTexture() const;
+        /* Shader storage buffer with a gpu_glyph per character sorted by code point, the normal
+         * glyphs only (no subpixel variants). It's built the first time and again when the
+         * generation changes. */
+        GLuint getGlyphBuffer(uint& num_glyphs) const;
+
+        /* Bakes the characters of the atlas again with another font (nullptr keeps it) or size
+         * on a worker thread, with the same options, kerning and outlines. The atlas doubles
+         * its size while they don't fit, up to ATLAS_REBAKE_MAX_SIZE, and keeps the old glyphs
+         * until swapRebaked. Returns false while another re-bake is running, or if there's
+         * neither a font nor a path. */
+        bool rebake(const char* path, int size);
+        /* Call it from the GL thread, once per frame for instance. If the re-bake finished it
+         * takes the new glyphs, uploads them and returns true. If the font failed to load or the
+         * glyphs didn't fit it reports it and keeps the old ones. The generation changes, so the
+         * Text2D objects that use this atlas measure and lay out their text again in their
+         * next render. Not while batches are recorded (see TextBatch). */
+        bool swapRebaked();
+        bool isRebaking() const;
+        int getFontSize() const; // pixels, 0 for baked atlases
 
-        // new function to calculate the width of a string?
+        /* Measures a string without creating any GL state. Results are memoized per text,
+         * scale and style, the pointer stays valid until the next call to measure or createAtlas. */
+        void measure(const wchar_t* text, float scale, const text_metrics** metrics,
+                     uint style = 0) const;
+        // not memoized, can be called from several threads while the atlas isn't rebuilt
+        void measure(const wchar_t* text, float scale, struct text_metrics& metrics,
+                     uint style = 0) const;
+        void clearMetricsCache();
+        // changes every time the glyphs are rebuilt (createAtlas, loadAtlas), never 0
+        uint getGeneration() const;
+        /* Hash of the glyph table, the outlines and the rendering options, the same in every
+         * run for the same glyphs (see TextBlob). 0 before the atlas is created. */
+        uint64_t getFingerprint() const;
 };
 
 
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <iostream>
+#include <cstdlib>
+#include <climits>
+#ifdef DEBUG
+    #include <cassert>
+#endif // DEBUG
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "FontRegistry.h"
+
+
+std::mutex FontRegistry::s_mutex;
+std::recursive_mutex FontRegistry::s_face_mutex;
+FT_Library FontRegistry::s_ft = nullptr;
+std::vector<struct FontRegistry::font_file> FontRegistry::s_files;
+uint FontRegistry::s_num_loads = 0;
+
+
+FT_Face FontRegistry::acquire(const char* path){
+#ifdef DEBUG
+    assert(path);
+#endif // DEBUG
+    std::lock_guard<std::mutex> lock(s_mutex);
+    char resolved[PATH_MAX];
+    struct font_file file;
+    struct stat st;
+    int fd;
+
+    // the same file can be reached through different paths
+    file.path = realpath(path, resolved) ? resolved : path;
+
+    for(uint i=0; i < s_files.size(); i++){
+        if(s_files[i].path == file.path){
+            s_files[i].refs++;
+            return s_files[i].face;
+        }
+    }
+
+    if(!s_ft && FT_Init_FreeType(&s_ft)){
+        std::cerr << "FontRegistry::acquire: Freetype error - could not initialize FreeType"
+                  << std::endl;
+        s_ft = nullptr;
+        return nullptr;
+    }
+
+    fd = open(file.path.c_str(), O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) || !st.st_size){
+        if(fd >= 0)
+            close(fd);
+        return nullptr;
+    }
+    file.size = st.st_size;
+    file.data = mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(file.data == MAP_FAILED)
+        return nullptr;
+
+    if(FT_New_Memory_Face(s_ft, static_cast<const FT_Byte*>(file.data), file.size, 0,
+                          &file.face)){
+        munmap(file.data, file.size);
+        return nullptr;
+    }
+    file.refs = 1;
+    s_files.push_back(file);
+    s_num_loads++;
+
+    return file.face;
+}
+
+
+void FontRegistry::release(FT_Face face){
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    for(uint i=0; i < s_files.size(); i++){
+        if(s_files[i].face != face)
+            continue;
+
+        if(!--s_files[i].refs){
+            FT_Done_Face(s_files[i].face);
+            munmap(s_files[i].data, s_files[i].size);
+            s_files.erase(s_files.begin() + i);
+        }
+        break;
+    }
+
+    if(s_files.empty() && s_ft){
+        FT_Done_FreeType(s_ft);
+        s_ft = nullptr;
+    }
+}
+
+
+std::recursive_mutex& FontRegistry::getFaceMutex(){
+    return s_face_mutex;
+}
+
+
+uint FontRegistry::getFaceCount(){
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_files.size();
+}
+
+
+uint FontRegistry::getLoadCount(){
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_num_loads;
+}
+
+
+size_t FontRegistry::getMappedBytes(){
+    std::lock_guard<std::mutex> lock(s_mutex);
+    size_t bytes = 0;
+
+    for(uint i=0; i < s_files.size(); i++)
+        bytes += s_files[i].size;
+    return bytes;
+}
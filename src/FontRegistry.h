@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#ifndef FONT_REGISTRY_H
+#define FONT_REGISTRY_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+
+/* Process wide registry of font files. Each file is memory mapped once and opened as a single
+ * FT_Face, shared by every atlas that uses it through its own FT_Size. All the faces share one
+ * FT_Library, which is created with the first face and destroyed with the last one. FreeType
+ * faces aren't thread safe, the atlases hold the face lock while they use theirs so they can be
+ * baked on any thread (see FontAtlas::rebake). */
+class FontRegistry{
+    private:
+        struct font_file{
+            std::string path;
+            void* data;
+            size_t size;
+            FT_Face face;
+            uint refs;
+        };
+
+        static std::mutex s_mutex;
+        static std::recursive_mutex s_face_mutex;
+        static FT_Library s_ft;
+        static std::vector<struct font_file> s_files;
+        static uint s_num_loads;
+    public:
+        // returns nullptr on failure, every successful call must be matched with a release
+        static FT_Face acquire(const char* path);
+        static void release(FT_Face face);
+        static std::recursive_mutex& getFaceMutex();
+
+        static uint getFaceCount();
+        static uint getLoadCount(); // number of times a file had to be mapped
+        static size_t getMappedBytes();
+};
+
+
+#endif
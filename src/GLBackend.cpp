@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+
+#include <GL/glew.h>
+
+#include "GLBackend.h"
+#include "FontAtlas.h"
+#include "Text2D.h"
+
+
+GLuint GLBackend::s_quad_indices = 0;
+uint GLBackend::s_quad_capacity = 0;
+uint GLBackend::s_num_users = 0;
+
+
+GLBackend::GLBackend(GLuint shader){
+    m_shader = shader;
+    m_draw_ms = 0.0;
+
+    glGenVertexArrays(1, &m_vao);
+    glBindVertexArray(m_vao);
+
+    glGenBuffers(1, &m_vbo_vert);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vert);
+    glVertexAttribPointer(0, 2,  GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(1, &m_vbo_tex);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_tex);
+    glVertexAttribPointer(1, 2,  GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(1);
+
+    glGenBuffers(1, &m_vbo_col);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_col);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(2);
+
+    if(!s_num_users++)
+        glGenBuffers(1, &s_quad_indices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_quad_indices); // stored in the VAO
+
+    m_disp_location = glGetUniformLocation(m_shader, "disp");
+    m_curve_location = glGetUniformLocation(m_shader, "curve_sampler");
+    m_effects_location = glGetUniformLocation(m_shader, "effects");
+
+#ifdef PTT_PROFILE
+    glGenQueries(GPU_TIMER_QUERIES, m_gpu_queries);
+    for(uint i=0; i < GPU_TIMER_QUERIES; i++)
+        m_gpu_query_issued[i] = false;
+    m_frame = 0;
+#endif // PTT_PROFILE
+}
+
+
+GLBackend::~GLBackend(){
+    glDeleteBuffers(1, &m_vbo_vert);
+    glDeleteBuffers(1, &m_vbo_tex);
+    if(!--s_num_users){
+        glDeleteBuffers(1, &s_quad_indices);
+        s_quad_indices = 0;
+        s_quad_capacity = 0;
+    }
+    glDeleteBuffers(1, &m_vbo_col);
+    glDeleteVertexArrays(1, &m_vao);
+#ifdef PTT_PROFILE
+    glDeleteQueries(GPU_TIMER_QUERIES, m_gpu_queries);
+#endif // PTT_PROFILE
+}
+
+
+void GLBackend::setGeometry(const float* vertices, const float* tex_coords, const float* colors,
+                            uint num_glyphs, uint capacity){
+    // the spare room is for glyphs that are rewritten every frame
+    GLenum usage = capacity > num_glyphs ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+
+    glBindVertexArray(m_vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vert);
+    glBufferData(GL_ARRAY_BUFFER, 8 * capacity * sizeof(GLfloat), NULL, usage);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, 8 * num_glyphs * sizeof(GLfloat), vertices);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_tex);
+    glBufferData(GL_ARRAY_BUFFER, 8 * capacity * sizeof(GLfloat), NULL, usage);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, 8 * num_glyphs * sizeof(GLfloat), tex_coords);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_col);
+    glBufferData(GL_ARRAY_BUFFER, 16 * capacity * sizeof(GLfloat), NULL, usage);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, 16 * num_glyphs * sizeof(GLfloat), colors);
+
+    reserveQuadIndices(std::min(capacity, (uint)QUAD_INDEX_CHUNK));
+}
+
+
+void GLBackend::updateGeometry(uint first_glyph, const float* vertices, const float* tex_coords,
+                               const float* colors, uint num_glyphs){
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vert);
+    glBufferSubData(GL_ARRAY_BUFFER, 8 * first_glyph * sizeof(GLfloat),
+                    8 * num_glyphs * sizeof(GLfloat), vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_tex);
+    glBufferSubData(GL_ARRAY_BUFFER, 8 * first_glyph * sizeof(GLfloat),
+                    8 * num_glyphs * sizeof(GLfloat), tex_coords);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_col);
+    glBufferSubData(GL_ARRAY_BUFFER, 16 * first_glyph * sizeof(GLfloat),
+                    16 * num_glyphs * sizeof(GLfloat), colors);
+}
+
+
+void GLBackend::getBuffers(GLuint buffers[3]) const{
+    buffers[0] = m_vbo_vert;
+    buffers[1] = m_vbo_tex;
+    buffers[2] = m_vbo_col;
+}
+
+
+void GLBackend::addDrawRange(uint first_quad, uint num_quads){
+    while(num_quads){
+        uint chunk = std::min(num_quads, (uint)QUAD_INDEX_CHUNK);
+
+        m_draw_counts.push_back(chunk * 6);
+        m_draw_offsets.push_back(NULL);
+        m_draw_base_vertex.push_back(first_quad * 4);
+        first_quad += chunk;
+        num_quads -= chunk;
+    }
+}
+
+
+void GLBackend::reserveQuadIndices(uint num_quads){
+    if(num_quads <= s_quad_capacity)
+        return;
+    // grows by doubling up to a full chunk, the buffer is small anyway (192 KiB at most)
+    uint capacity = std::min(std::max(num_quads, s_quad_capacity * 2), (uint)QUAD_INDEX_CHUNK);
+    std::unique_ptr<GLushort[]> indices(new GLushort[6 * capacity]);
+
+    for(uint i=0; i < capacity; i++){
+        uint index = i * 6, disp = i * 4;
+        indices[index] = disp;
+        indices[index + 1] = disp + 2;
+        indices[index + 2] = disp + 1;
+        indices[index + 3] = disp;
+        indices[index + 4] = disp + 3;
+        indices[index + 5] = disp + 2;
+    }
+    // the binding point is part of the VAO, which is bound and already points to the buffer
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_quad_indices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * capacity * sizeof(GLushort), indices.get(),
+                 GL_STATIC_DRAW);
+    s_quad_capacity = capacity;
+}
+
+
+void GLBackend::draw(const FontAtlas* atlas, const struct quad_range* ranges, uint num_ranges,
+                     const float disp[2]){
+#ifdef PTT_PROFILE
+    uint query = m_frame++ % GPU_TIMER_QUERIES;
+    if(m_gpu_query_issued[query]){ // issued GPU_TIMER_QUERIES frames ago, don't stall if late
+        GLint available = 0;
+        GLuint64 gpu_ns;
+        glGetQueryObjectiv(m_gpu_queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available){
+            glGetQueryObjectui64v(m_gpu_queries[query], GL_QUERY_RESULT, &gpu_ns);
+            m_draw_ms = gpu_ns / 1e6;
+        }
+    }
+#endif // PTT_PROFILE
+    m_draw_counts.clear();
+    m_draw_offsets.clear();
+    m_draw_base_vertex.clear();
+    for(uint i=0; i < num_ranges; i++)
+        addDrawRange(ranges[i].first, ranges[i].count);
+
+    glUseProgram(m_shader);
+    glBindVertexArray(m_vao);
+    glUniform2f(m_disp_location, disp[0], disp[1]);
+    if(m_curve_location >= 0)
+        glUniform1i(m_curve_location, 1); // see FontAtlas::bindTexture
+    if(m_effects_location >= 0 && m_effects.size()) // the program may be shared
+        glUniform4fv(m_effects_location, m_effects.size() / 4, m_effects.data());
+    atlas->bindTexture();
+
+#ifdef PTT_PROFILE
+    glBeginQuery(GL_TIME_ELAPSED, m_gpu_queries[query]);
+#endif // PTT_PROFILE
+    if(m_draw_counts.size() == 1)
+        glDrawElementsBaseVertex(GL_TRIANGLES, m_draw_counts[0], GL_UNSIGNED_SHORT, NULL,
+                                 m_draw_base_vertex[0]);
+    else if(m_draw_counts.size())
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, m_draw_counts.data(), GL_UNSIGNED_SHORT,
+                                      m_draw_offsets.data(), m_draw_counts.size(),
+                                      m_draw_base_vertex.data());
+#ifdef PTT_PROFILE
+    glEndQuery(GL_TIME_ELAPSED);
+    m_gpu_query_issued[query] = true;
+#endif // PTT_PROFILE
+}
+
+
+double GLBackend::getDrawTime() const{
+    return m_draw_ms;
+}
+
+
+void GLBackend::setEffects(const struct text_effect* effects, uint num_effects){
+    m_effects.assign(12, 0.0f);
+    for(uint i=0; i < num_effects; i++){
+        const struct text_effect& effect = effects[i];
+        float params[4] = {effect.outline_width, effect.shadow_offset[0], effect.shadow_offset[1],
+                           effect.shadow_softness};
+        m_effects.insert(m_effects.end(), effect.outline_color, effect.outline_color + 4);
+        m_effects.insert(m_effects.end(), effect.shadow_color, effect.shadow_color + 4);
+        m_effects.insert(m_effects.end(), params, params + 4);
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#ifndef GL_BACKEND_H
+#define GL_BACKEND_H
+
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "RenderBackend.h"
+
+
+/* All the GL backends share a static buffer of 16 bit quad indices (0, 2, 1, 0, 3, 2, 4...)
+ * that covers this many quads, longer ranges are drawn in chunks with a base vertex. */
+#define QUAD_INDEX_CHUNK 16384
+
+// GPU timer queries in flight with PTT_PROFILE, the results are read this many frames later
+#define GPU_TIMER_QUERIES 3
+
+
+/*
+ * OpenGL 4.1 backend, one VAO and one VBO per attribute (locations 0, 1 and 2). The shader
+ * is expected to have a "disp" uniform (see example/graphics.cpp), and a "curve_sampler" one
+ * if it draws outlines (see FontAtlas::loadOutlines). The string effects go to an "effects"
+ * uniform array, three vec4 per effect: outline color, shadow color and (outline width, shadow
+ * offset x, y, shadow softness), the first three are unused.
+ */
+class GLBackend : public RenderBackend{
+    private:
+        GLuint m_vao, m_vbo_vert, m_vbo_tex, m_vbo_col;
+        GLuint m_shader;
+        GLint m_disp_location, m_curve_location, m_effects_location;
+        std::vector<float> m_effects;
+
+        // draw ranges, in chunks of at most QUAD_INDEX_CHUNK quads
+        std::vector<GLsizei> m_draw_counts;
+        std::vector<const void*> m_draw_offsets;
+        std::vector<GLint> m_draw_base_vertex;
+
+        // shared quad indices, the buffer is deleted with the last backend
+        static GLuint s_quad_indices;
+        static uint s_quad_capacity;
+        static uint s_num_users;
+
+#ifdef PTT_PROFILE
+        GLuint m_gpu_queries[GPU_TIMER_QUERIES];
+        bool m_gpu_query_issued[GPU_TIMER_QUERIES];
+        uint m_frame;
+#endif // PTT_PROFILE
+        double m_draw_ms;
+
+        void addDrawRange(uint first_quad, uint num_quads);
+        static void reserveQuadIndices(uint num_quads);
+    public:
+        GLBackend(GLuint shader);
+        ~GLBackend();
+
+        void setGeometry(const float* vertices, const float* tex_coords, const float* colors,
+                         uint num_glyphs, uint capacity);
+        void updateGeometry(uint first_glyph, const float* vertices, const float* tex_coords,
+                            const float* colors, uint num_glyphs);
+        void draw(const FontAtlas* atlas, const struct quad_range* ranges, uint num_ranges,
+                  const float disp[2]);
+        double getDrawTime() const;
+        void setEffects(const struct text_effect* effects, uint num_effects);
+        // vertex, texture coordinate and color VBOs, for compute shaders that write the geometry
+        void getBuffers(GLuint buffers[3]) const;
+};
+
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#ifdef DEBUG
+    #include <cassert>
+#endif // DEBUG
+
+#include <GL/glew.h>
+
+#include "GLLabels.h"
+#include "GLBackend.h"
+#include "FontAtlas.h"
+#include "Text2D.h"
+
+
+#define LABELS_LOG_LENGTH 2048
+
+/* Buffers shared by both passes. The float math is the one of Text2D::layoutGlyph and
+ * Text2D::getPenXY in the same order, and precise keeps it from being fused, so the quads
+ * are the same as the ones laid out on the CPU. */
+const GLchar labels_common[] = "#version 430\n"
+                               "layout(local_size_x = 64) in;\n" // LABELS_LOCAL_SIZE
+
+                               // see gpu_glyph and gpu_label
+                               "struct glyph{\n"
+                                   "vec4 tex;\n"
+                                   "uint code;\n"
+                                   "int bearing_x, bearing_y, width, height, advance;\n"
+                                   "uint pad0, pad1;\n"
+                               "};\n"
+                               "struct label{\n"
+                                   "vec4 color;\n"
+                                   "uint first_code, num_codes, first_glyph;\n"
+                                   "float scale;\n"
+                                   "uint align_x, align_y, pad0, pad1;\n"
+                               "};\n"
+                               // pen position from the label origin, before the alignment
+                               "struct glyph_pen{\n"
+                                   "float x, y;\n"
+                                   "uint glyph, label;\n"
+                               "};\n"
+
+                               "layout(std430, binding = 0) readonly buffer Glyphs{ glyph glyphs[]; };\n"
+                               "layout(std430, binding = 1) readonly buffer Labels{ label labels[]; };\n"
+                               "layout(std430, binding = 2) buffer Pens{ glyph_pen pens[]; };\n"
+                               "layout(std430, binding = 3) buffer Offsets{ vec2 offsets[]; };\n"
+
+                               "uint invocation(){\n"
+                                   "return gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x +\n"
+                                   "       gl_GlobalInvocationID.x;\n"
+                               "}\n";
+
+
+// one invocation per label, its glyph pens and alignment offset
+const GLchar labels_layout[] = "layout(std430, binding = 4) readonly buffer Codes{ uint codes[]; };\n"
+                               "uniform uint num_labels;\n"
+                               "uniform uint num_table;\n"
+                               "uniform float font_height;\n" // whole pixels
+
+                               // the glyph of code, or the one of code 0 if it's missing
+                               "uint lookup(uint code){\n"
+                                   "uint low = 0u, high = num_table;\n"
+                                   "while(low < high){\n"
+                                       "uint mid = (low + high) / 2u;\n"
+                                       "if(glyphs[mid].code < code)\n"
+                                           "low = mid + 1u;\n"
+                                       "else\n"
+                                           "high = mid;\n"
+                                   "}\n"
+                                   "return low < num_table && glyphs[low].code == code ? low : 0u;\n"
+                               "}\n"
+
+                               "void main(){\n"
+                                   "uint i = invocation();\n"
+                                   "if(i >= num_labels)\n"
+                                       "return;\n"
+                                   "label l = labels[i];\n"
+                                   "uint k = l.first_glyph, line = 0u;\n"
+                                   "precise float pen = 0.0, pen_y = 0.0, width = 0.0;\n"
+                                   "precise float line_height = font_height * l.scale;\n"
+                                   "for(uint j=0u; j < l.num_codes; j++){\n"
+                                       "uint code = codes[l.first_code + j];\n"
+                                       "if(code == 10u){\n"
+                                           "width = max(width, pen);\n"
+                                           "pen = 0.0;\n"
+                                           "pen_y = 0.0 - line_height * float(++line);\n"
+                                           "continue;\n"
+                                       "}\n"
+                                       "uint g = lookup(code);\n"
+                                       "pens[k++] = glyph_pen(pen, pen_y, g, i);\n"
+                                       "pen += float(glyphs[g].advance) * l.scale;\n"
+                                   "}\n"
+                                   "width = max(width, pen);\n"
+
+                                   "uint w = uint(width);\n"
+                                   "uint h = uint(line_height * float(line + 1u));\n"
+                                   "precise vec2 offset = vec2(0.0);\n"
+                                   "if(l.align_x == 1u)\n"
+                                       "offset.x = 0.0 - float(w / 2u);\n"
+                                   "else if(l.align_x == 2u)\n"
+                                       "offset.x = 0.0 - float(w);\n"
+                                   "if(l.align_y == 1u)\n"
+                                       "offset.y = float(h / 2u) - line_height;\n"
+                                   "offsets[i] = offset;\n"
+                               "}\n";
+
+
+// one invocation per glyph, its quad in the vertex buffers of the backend
+const GLchar labels_quads[] = "layout(std430, binding = 4) readonly buffer Origins{ vec2 origins[]; };\n"
+                              "layout(std430, binding = 5) writeonly buffer Vertices{ float vertices[]; };\n"
+                              "layout(std430, binding = 6) writeonly buffer TexCoords{ float tex_coords[]; };\n"
+                              "layout(std430, binding = 7) writeonly buffer Colors{ vec4 colors[]; };\n"
+                              "uniform uint num_glyphs;\n"
+
+                              "void main(){\n"
+                                  "uint i = invocation();\n"
+                                  "if(i >= num_glyphs)\n"
+                                      "return;\n"
+                                  "glyph_pen p = pens[i];\n"
+                                  "glyph ch = glyphs[p.glyph];\n"
+                                  "label l = labels[p.label];\n"
+                                  "precise vec2 origin = origins[p.label] + offsets[p.label];\n"
+                                  "precise float x = p.x + float(ch.bearing_x) * l.scale;\n"
+                                  "precise float y = p.y - float(ch.height - ch.bearing_y) * l.scale;\n"
+                                  "precise float right = x + float(ch.width) * l.scale;\n"
+                                  "precise float top = y + float(ch.height) * l.scale;\n"
+
+                                  "uint v = i * 8u;\n"
+                                  "vertices[v] = x + origin.x;\n"
+                                  "vertices[v + 1u] = y + origin.y;\n"
+                                  "vertices[v + 2u] = x + origin.x;\n"
+                                  "vertices[v + 3u] = top + origin.y;\n"
+                                  "vertices[v + 4u] = right + origin.x;\n"
+                                  "vertices[v + 5u] = top + origin.y;\n"
+                                  "vertices[v + 6u] = right + origin.x;\n"
+                                  "vertices[v + 7u] = y + origin.y;\n"
+
+                                  "tex_coords[v] = ch.tex.x;\n"
+                                  "tex_coords[v + 1u] = ch.tex.w;\n"
+                                  "tex_coords[v + 2u] = ch.tex.x;\n"
+                                  "tex_coords[v + 3u] = ch.tex.z;\n"
+                                  "tex_coords[v + 4u] = ch.tex.y;\n"
+                                  "tex_coords[v + 5u] = ch.tex.z;\n"
+                                  "tex_coords[v + 6u] = ch.tex.y;\n"
+                                  "tex_coords[v + 7u] = ch.tex.w;\n"
+
+                                  "for(uint c=0u; c < 4u; c++)\n"
+                                      "colors[i * 4u + c] = l.color;\n"
+                              "}\n";
+
+
+static GLuint create_compute_program(const GLchar* source){
+    const GLchar* sources[2] = {labels_common, source};
+    GLuint shader, program;
+    GLint params;
+    char message[LABELS_LOG_LENGTH];
+
+    shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 2, sources, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &params);
+    if(params != GL_TRUE){
+        glGetShaderInfoLog(shader, LABELS_LOG_LENGTH, NULL, message);
+        std::cerr << "GLLabels::GLLabels: the compute shader did not compile: " << message
+                  << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    glGetProgramiv(program, GL_LINK_STATUS, &params);
+    if(params != GL_TRUE){
+        glGetProgramInfoLog(program, LABELS_LOG_LENGTH, NULL, message);
+        std::cerr << "GLLabels::GLLabels: the compute program did not link: " << message
+                  << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+
+// rows of LABELS_MAX_GROUPS_X work groups, the shaders skip the invocations past the end
+static void dispatch(uint num_invocations){
+    uint groups = (num_invocations + LABELS_LOCAL_SIZE - 1) / LABELS_LOCAL_SIZE;
+    uint groups_x = std::min(groups, (uint)LABELS_MAX_GROUPS_X);
+
+    glDispatchCompute(groups_x, (groups + groups_x - 1) / groups_x, 1);
+}
+
+
+GLLabels::GLLabels(const FontAtlas* atlas, GLuint shader){
+#ifdef DEBUG
+    assert(atlas);
+#endif // DEBUG
+    GLint major = 0, minor = 0;
+
+    m_font_atlas = atlas;
+    m_backend = new GLBackend(shader);
+    m_layout_program = 0;
+    m_quad_program = 0;
+    m_num_glyphs = 0;
+    m_capacity = 0;
+    m_atlas_generation = 0;
+    m_update_labels = false;
+    m_moved_first = 0;
+    m_moved_end = 0;
+
+    glGenBuffers(1, &m_codes_buffer);
+    glGenBuffers(1, &m_labels_buffer);
+    glGenBuffers(1, &m_origins_buffer);
+    glGenBuffers(1, &m_pens_buffer);
+    glGenBuffers(1, &m_offsets_buffer);
+
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    m_supported = major > 4 || (major == 4 && minor >= 3);
+    if(!m_supported){
+        std::cerr << "GLLabels::GLLabels: compute shaders need OpenGL 4.3, the context is "
+                  << major << "." << minor << std::endl;
+        return;
+    }
+
+    m_layout_program = create_compute_program(labels_layout);
+    m_quad_program = create_compute_program(labels_quads);
+    m_supported = m_layout_program && m_quad_program;
+
+    m_num_labels_location = glGetUniformLocation(m_layout_program, "num_labels");
+    m_num_table_location = glGetUniformLocation(m_layout_program, "num_table");
+    m_font_height_location = glGetUniformLocation(m_layout_program, "font_height");
+    m_num_glyphs_location = glGetUniformLocation(m_quad_program, "num_glyphs");
+}
+
+
+GLLabels::~GLLabels(){
+    glDeleteBuffers(1, &m_codes_buffer);
+    glDeleteBuffers(1, &m_labels_buffer);
+    glDeleteBuffers(1, &m_origins_buffer);
+    glDeleteBuffers(1, &m_pens_buffer);
+    glDeleteBuffers(1, &m_offsets_buffer);
+    glDeleteProgram(m_layout_program);
+    glDeleteProgram(m_quad_program);
+    delete m_backend;
+}
+
+
+bool GLLabels::isSupported() const{
+    return m_supported;
+}
+
+
+uint GLLabels::addLabel(const wchar_t* text, float x, float y, float scale, int alignment,
+                        const float color[4]){
+#ifdef DEBUG
+    assert(text);
+    assert(color);
+#endif // DEBUG
+    struct gpu_label label = {};
+
+    std::memcpy(label.color, color, sizeof(float) * 4);
+    label.first_code = m_codes.size();
+    label.first_glyph = m_num_glyphs;
+    label.scale = scale;
+    if(alignment == STRING_ALIGN_CENTER_X || alignment == STRING_ALIGN_CENTER_XY)
+        label.align_x = 1;
+    else if(alignment == STRING_ALIGN_LEFT)
+        label.align_x = 2;
+    label.align_y = alignment == STRING_ALIGN_CENTER_Y || alignment == STRING_ALIGN_CENTER_XY;
+
+    for(uint i=0; text[i] != '\0'; i++){
+        m_codes.push_back(text[i]);
+        if(text[i] != '\n')
+            m_num_glyphs++;
+    }
+    label.num_codes = m_codes.size() - label.first_code;
+
+    m_labels.push_back(label);
+    m_origins.push_back(x);
+    m_origins.push_back(y);
+    m_update_labels = true;
+
+    return m_labels.size() - 1;
+}
+
+
+void GLLabels::setPosition(uint index, float x, float y){
+    float position[2] = {x, y};
+
+    setPositions(index, 1, position);
+}
+
+
+void GLLabels::setPositions(uint first, uint count, const float* positions){
+#ifdef DEBUG
+    assert(first + count <= m_labels.size());
+#endif // DEBUG
+    if(!count)
+        return;
+    std::memcpy(&m_origins[first * 2], positions, sizeof(float) * 2 * count);
+    if(m_moved_first < m_moved_end){
+        m_moved_first = std::min(m_moved_first, first);
+        m_moved_end = std::max(m_moved_end, first + count);
+    }
+    else{
+        m_moved_first = first;
+        m_moved_end = first + count;
+    }
+}
+
+
+void GLLabels::clearLabels(){
+    m_codes.clear();
+    m_labels.clear();
+    m_origins.clear();
+    m_num_glyphs = 0;
+    m_moved_first = m_moved_end = 0;
+    m_update_labels = true;
+}
+
+
+uint GLLabels::size() const{
+    return m_labels.size();
+}
+
+
+uint GLLabels::getGlyphCount() const{
+    return m_num_glyphs;
+}
+
+
+void GLLabels::layoutLabels(){
+    uint num_table;
+    GLuint glyph_buffer = m_font_atlas->getGlyphBuffer(num_table);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_codes_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_codes.size() * sizeof(uint), m_codes.data(),
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_labels_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_labels.size() * sizeof(struct gpu_label),
+                 m_labels.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_origins_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_origins.size() * sizeof(float), m_origins.data(),
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_pens_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_num_glyphs * sizeof(float) * 4, NULL,
+                 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_offsets_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_labels.size() * sizeof(float) * 2, NULL,
+                 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if(m_num_glyphs > m_capacity){
+        m_capacity = std::max(m_num_glyphs, m_capacity * 2);
+        m_backend->setGeometry(nullptr, nullptr, nullptr, 0, m_capacity);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, glyph_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_labels_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_pens_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_offsets_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_codes_buffer);
+    glUseProgram(m_layout_program);
+    glUniform1ui(m_num_labels_location, m_labels.size());
+    glUniform1ui(m_num_table_location, num_table);
+    glUniform1f(m_font_height_location, (float)(m_font_atlas->getHeight() >> 6));
+    dispatch(m_labels.size());
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    m_atlas_generation = m_font_atlas->getGeneration();
+    m_update_labels = false;
+    m_moved_first = m_moved_end = 0; // the origins went with the labels
+}
+
+
+void GLLabels::writeQuads(){
+    GLuint buffers[3];
+    uint num_table;
+
+    m_backend->getBuffers(buffers);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_font_atlas->getGlyphBuffer(num_table));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_labels_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_pens_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_offsets_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_origins_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, buffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, buffers[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, buffers[2]);
+    glUseProgram(m_quad_program);
+    glUniform1ui(m_num_glyphs_location, m_num_glyphs);
+    dispatch(m_num_glyphs);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+
+void GLLabels::render(){
+    const float disp[2] = {0.0f, 0.0f};
+    struct quad_range range = {0, m_num_glyphs};
+
+    // nothing to look the glyphs up in before the atlas is created
+    if(!m_supported || !m_num_glyphs || !m_font_atlas->getCharacterCount())
+        return;
+
+    if(m_update_labels || m_atlas_generation != m_font_atlas->getGeneration()){
+        layoutLabels();
+        writeQuads();
+    }
+    else if(m_moved_first < m_moved_end){
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_origins_buffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, m_moved_first * sizeof(float) * 2,
+                        (m_moved_end - m_moved_first) * sizeof(float) * 2,
+                        &m_origins[m_moved_first * 2]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        m_moved_first = m_moved_end = 0;
+        writeQuads();
+    }
+
+    m_backend->draw(m_font_atlas, &range, 1, disp);
+}
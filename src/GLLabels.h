@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef GL_LABELS_H
+#define GL_LABELS_H
+
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+class FontAtlas;
+class GLBackend;
+
+
+// invocations per work group of the compute shaders, and work groups per row of the dispatch
+#define LABELS_LOCAL_SIZE 64
+#define LABELS_MAX_GROUPS_X 65535
+
+// std430 layout of the label table of the compute shaders
+struct gpu_label{
+    float color[4];
+    uint first_code;
+    uint num_codes; // line breaks included
+    uint first_glyph;
+    float scale;
+    uint align_x; // 0 none, 1 half the width (STRING_ALIGN_CENTER_X), 2 the width (STRING_ALIGN_LEFT)
+    uint align_y; // 1 for STRING_ALIGN_CENTER_Y
+    uint padding[2];
+};
+
+
+/*
+ * Many short labels (point clouds, graphs, maps...) laid out by compute shaders straight into
+ * the vertex buffers, needs OpenGL 4.3. The code points and the label table are uploaded when
+ * labels are added or the atlas generation changes, then one invocation per label lays out
+ * its pen positions and alignment. Moving labels only uploads their positions, and one
+ * invocation per glyph writes its quad. The positions are framebuffer pixels from the bottom
+ * left corner, the quads are the ones Text2D lays out with the normal glyphs. There's no
+ * bidi reordering, subpixel positioning, outlines, effects, culling nor hit testing.
+ */
+class GLLabels{
+    private:
+        const FontAtlas* m_font_atlas;
+        GLBackend* m_backend;
+        GLuint m_layout_program, m_quad_program;
+        GLint m_num_labels_location, m_num_table_location, m_font_height_location;
+        GLint m_num_glyphs_location;
+        GLuint m_codes_buffer, m_labels_buffer, m_origins_buffer, m_pens_buffer, m_offsets_buffer;
+        bool m_supported;
+
+        std::vector<uint> m_codes;
+        std::vector<struct gpu_label> m_labels;
+        std::vector<float> m_origins;
+        uint m_num_glyphs, m_capacity;
+        uint m_atlas_generation;
+        bool m_update_labels;
+        uint m_moved_first, m_moved_end; // labels whose position has to be uploaded
+
+        void layoutLabels();
+        void writeQuads();
+    public:
+        // shader is the program the quads are drawn with (see GLBackend)
+        GLLabels(const FontAtlas* atlas, GLuint shader);
+        ~GLLabels();
+        GLLabels(const GLLabels&) = delete;
+        GLLabels& operator=(const GLLabels&) = delete;
+
+        // false if the compute shaders aren't available, nothing is drawn then
+        bool isSupported() const;
+
+        // returns the index of the label, the alignment is one of STRING_ALIGN_*
+        uint addLabel(const wchar_t* text, float x, float y, float scale, int alignment,
+                      const float color[4]);
+        void setPosition(uint index, float x, float y);
+        // x, y pairs of count labels starting at first
+        void setPositions(uint first, uint count, const float* positions);
+        void clearLabels();
+        uint size() const;
+        uint getGlyphCount() const;
+
+        void render();
+};
+
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#ifndef RENDER_BACKEND_H
+#define RENDER_BACKEND_H
+
+#include <sys/types.h>
+
+class FontAtlas;
+struct text_effect;
+
+
+// range of quads to draw, in glyphs
+struct quad_range{
+    uint first;
+    uint count;
+};
+
+
+/*
+ * Where Text2D sends its geometry. Each glyph is a quad of 4 vertices (bottom left, top left,
+ * top right, bottom right) with 2 position floats, 2 texture coordinate floats and 4 color
+ * floats each, in framebuffer pixels from the bottom left corner.
+ */
+class RenderBackend{
+    public:
+        virtual ~RenderBackend(){}
+
+        // replaces the geometry with num_glyphs quads and makes room for capacity quads
+        virtual void setGeometry(const float* vertices, const float* tex_coords,
+                                 const float* colors, uint num_glyphs, uint capacity) = 0;
+        // overwrites num_glyphs quads starting at first_glyph, which must fit in the capacity
+        virtual void updateGeometry(uint first_glyph, const float* vertices,
+                                    const float* tex_coords, const float* colors,
+                                    uint num_glyphs) = 0;
+        // draws the ranges with the atlas texture, the vertices are moved by disp
+        virtual void draw(const FontAtlas* atlas, const struct quad_range* ranges,
+                          uint num_ranges, const float disp[2]) = 0;
+        /* Time spent drawing in ms, the latest available. The GL backend only measures it
+         * with PTT_PROFILE (it's GPU time and a few frames old). */
+        virtual double getDrawTime() const = 0;
+        /* Effect table of the strings, the glyphs refer to it through their texture
+         * coordinates (see Text2D::setStringEffect). Ignored by backends without effects. */
+        virtual void setEffects(const struct text_effect* effects, uint num_effects){
+            (void)effects;
+            (void)num_effects;
+        }
+};
+
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif // __SSE2__
+#ifdef DEBUG
+    #include <cassert>
+#endif // DEBUG
+
+#ifndef PTT_NO_GL
+    #include <GL/glew.h> // GLuint in FontAtlas.h
+#endif // PTT_NO_GL
+
+#include "SoftwareBackend.h"
+#include "FontAtlas.h"
+
+
+SoftwareBackend::SoftwareBackend(uint width, uint height, uint num_threads){
+    m_num_threads = num_threads ? num_threads : std::max(std::thread::hardware_concurrency(), 1u);
+    m_atlas = nullptr;
+    m_atlas_size = 0;
+    m_curves = nullptr;
+    m_disp[0] = 0.0f;
+    m_disp[1] = 0.0f;
+    m_draw_ms = 0.0;
+    m_pixels_drawn = 0;
+    resize(width, height);
+}
+
+
+void SoftwareBackend::resize(uint width, uint height){
+    m_width = width;
+    m_height = height;
+    m_pixels.assign(width * height * 4, 0);
+    m_tiles_x = (width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    m_tiles_y = (height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    m_tiles.resize(m_tiles_x * m_tiles_y);
+}
+
+
+void SoftwareBackend::clear(const float color[4]){
+    unsigned char rgba[4];
+
+    for(uint i=0; i < 4; i++)
+        rgba[i] = std::min(std::max(color[i], 0.0f), 1.0f) * 255.0f + 0.5f;
+    for(uint i=0; i < m_width * m_height; i++)
+        std::memcpy(&m_pixels[i * 4], rgba, 4);
+}
+
+
+const unsigned char* SoftwareBackend::getPixels() const{
+    return m_pixels.data();
+}
+
+
+uint SoftwareBackend::getWidth() const{
+    return m_width;
+}
+
+
+uint SoftwareBackend::getHeight() const{
+    return m_height;
+}
+
+
+size_t SoftwareBackend::getPixelsDrawn() const{
+    return m_pixels_drawn;
+}
+
+
+double SoftwareBackend::getDrawTime() const{
+    return m_draw_ms;
+}
+
+
+bool SoftwareBackend::savePPM(const char* path) const{
+    std::ofstream file(path, std::ios::binary);
+
+    if(!file.is_open()){
+        std::cerr << "SoftwareBackend::savePPM: failed to open " << path << std::endl;
+        return false;
+    }
+    file << "P6\n" << m_width << " " << m_height << "\n255\n";
+    for(uint y=m_height; y-- > 0;){
+        for(uint x=0; x < m_width; x++)
+            file.write((const char*)&m_pixels[(y * m_width + x) * 4], 3);
+    }
+    return file.good();
+}
+
+
+void SoftwareBackend::setGeometry(const float* vertices, const float* tex_coords,
+                                  const float* colors, uint num_glyphs, uint capacity){
+    m_vertices.resize(8 * capacity);
+    m_tex_coords.resize(8 * capacity);
+    m_colors.resize(16 * capacity);
+    std::copy(vertices, vertices + 8 * num_glyphs, m_vertices.begin());
+    std::copy(tex_coords, tex_coords + 8 * num_glyphs, m_tex_coords.begin());
+    std::copy(colors, colors + 16 * num_glyphs, m_colors.begin());
+}
+
+
+void SoftwareBackend::updateGeometry(uint first_glyph, const float* vertices,
+                                     const float* tex_coords, const float* colors,
+                                     uint num_glyphs){
+#ifdef DEBUG
+    assert(8 * (first_glyph + num_glyphs) <= m_vertices.size());
+#endif // DEBUG
+    std::copy(vertices, vertices + 8 * num_glyphs, m_vertices.begin() + 8 * first_glyph);
+    std::copy(tex_coords, tex_coords + 8 * num_glyphs, m_tex_coords.begin() + 8 * first_glyph);
+    std::copy(colors, colors + 16 * num_glyphs, m_colors.begin() + 16 * first_glyph);
+}
+
+
+void SoftwareBackend::draw(const FontAtlas* atlas, const struct quad_range* ranges,
+                           uint num_ranges, const float disp[2]){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<uint> next_tile(0);
+    std::vector<size_t> pixels(m_num_threads, 0);
+    std::vector<std::thread> threads;
+
+    m_pixels_drawn = 0;
+    m_atlas = atlas->getAtlas();
+    m_atlas_size = atlas->getAtlasSize();
+    m_curves = atlas->getCurves();
+    if(!m_atlas || atlas->getLcdRendering() || atlas->getSdfRendering()){
+        std::cerr << "SoftwareBackend::draw: the atlas has no pixels in memory or uses LCD "
+                  << "or distance field rendering" << std::endl;
+        return;
+    }
+    m_disp[0] = disp[0];
+    m_disp[1] = disp[1];
+
+    // bin the glyphs, the order within each tile is the draw order
+    for(uint i=0; i < m_tiles.size(); i++)
+        m_tiles[i].clear();
+    for(uint i=0; i < num_ranges; i++){
+        for(uint glyph=ranges[i].first; glyph < ranges[i].first + ranges[i].count; glyph++){
+            const float* v = &m_vertices[glyph * 8];
+            // the quads of oblique styles are parallelograms (see Text2D::advanceGlyph)
+            float x_min = std::min(v[0], v[2]) + m_disp[0], y_min = v[1] + m_disp[1];
+            float x_max = std::max(v[4], v[6]) + m_disp[0], y_max = v[3] + m_disp[1];
+
+            if(x_max <= 0.0f || y_max <= 0.0f || x_min >= m_width || y_min >= m_height ||
+               x_max <= x_min || y_max <= y_min)
+                continue;
+            uint tx_min = std::max(x_min, 0.0f) / SOFTWARE_TILE_SIZE;
+            uint ty_min = std::max(y_min, 0.0f) / SOFTWARE_TILE_SIZE;
+            uint tx_max = std::min((uint)x_max / SOFTWARE_TILE_SIZE, m_tiles_x - 1);
+            uint ty_max = std::min((uint)y_max / SOFTWARE_TILE_SIZE, m_tiles_y - 1);
+            for(uint ty=ty_min; ty <= ty_max; ty++)
+                for(uint tx=tx_min; tx <= tx_max; tx++)
+                    m_tiles[ty * m_tiles_x + tx].push_back(glyph);
+        }
+    }
+
+    // tiles don't overlap, each thread takes the next one until there are none left
+    std::function<void(uint)> worker = [&](uint thread){
+        for(uint tile = next_tile++; tile < m_tiles.size(); tile = next_tile++)
+            pixels[thread] += drawTile(tile);
+    };
+    for(uint i=1; i < m_num_threads; i++)
+        threads.push_back(std::thread(worker, i));
+    worker(0);
+    for(uint i=0; i < threads.size(); i++)
+        threads[i].join();
+
+    for(uint i=0; i < m_num_threads; i++)
+        m_pixels_drawn += pixels[i];
+    m_draw_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                          start).count();
+}
+
+
+size_t SoftwareBackend::drawTile(uint tile){
+    int x_min = (tile % m_tiles_x) * SOFTWARE_TILE_SIZE;
+    int y_min = (tile / m_tiles_x) * SOFTWARE_TILE_SIZE;
+    int x_max = std::min(x_min + SOFTWARE_TILE_SIZE, (int)m_width);
+    int y_max = std::min(y_min + SOFTWARE_TILE_SIZE, (int)m_height);
+    size_t pixels = 0;
+
+    for(uint i=0; i < m_tiles[tile].size(); i++)
+        pixels += drawGlyph(m_tiles[tile][i], x_min, y_min, x_max, y_max);
+    return pixels;
+}
+
+
+// bilinear coverage of a row, like GL_LINEAR with clamping
+void SoftwareBackend::atlasCoverage(float u_pos, float du, float v_pos, int count,
+                                    float* coverage) const{
+    int max_texel = m_atlas_size - 1;
+    float vf = std::floor(v_pos), fy = v_pos - vf;
+    int ty0 = std::min(std::max((int)vf, 0), max_texel);
+    int ty1 = std::min(std::max((int)vf + 1, 0), max_texel);
+    const unsigned char* row0 = m_atlas + ty0 * m_atlas_size;
+    const unsigned char* row1 = m_atlas + ty1 * m_atlas_size;
+
+    for(int i=0; i < count; i++, u_pos += du){
+        float uf = std::floor(u_pos), fx = u_pos - uf;
+        int tx0 = std::min(std::max((int)uf, 0), max_texel);
+        int tx1 = std::min(std::max((int)uf + 1, 0), max_texel);
+        float top = row0[tx0] + (row0[tx1] - row0[tx0]) * fx;
+        float bottom = row1[tx0] + (row1[tx1] - row1[tx0]) * fx;
+        coverage[i] = (top + (bottom - top) * fy) * (1.0f / 255.0f);
+    }
+}
+
+
+// same as the crossing function of the outline shader (see example/graphics.cpp)
+static float outline_crossing(const float a[3], const float b[3], float pixel){
+    float qa, qb, t, x;
+
+    if((a[0] <= 0.0f) == (a[2] <= 0.0f))
+        return 0.0f;
+    qa = a[0] - 2.0f * a[1] + a[2];
+    qb = a[1] - a[0];
+    if(std::fabs(qa) < 1e-6f){
+        t = a[0] / (a[0] - a[2]);
+    }
+    else{
+        float d = std::sqrt(std::max(qb * qb - qa * a[0], 0.0f));
+        float t1 = (-qb - d) / qa, t2 = (-qb + d) / qa;
+        t = std::fabs(t1 - 0.5f) < std::fabs(t2 - 0.5f) ? t1 : t2;
+    }
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    x = (1.0f - t) * (1.0f - t) * b[0] + 2.0f * t * (1.0f - t) * b[1] + t * t * b[2];
+    return (a[2] > a[0] ? 1.0f : -1.0f) * std::min(std::max(x / pixel + 0.5f, 0.0f), 1.0f);
+}
+
+
+void SoftwareBackend::outlineCoverage(const float* t, float x0, float x1, float y0, float y1,
+                                      int px_min, int px_max, int py, float* coverage) const{
+    float cell_x = std::floor(t[0] / OUTLINE_CELL), cell_y = std::floor(t[1] / OUTLINE_CELL);
+    const uint16_t* header = &m_curves[((uint)cell_x - 1 + (uint)cell_y * OUTLINE_SLOTS_X) * 4];
+    const uint16_t* curves = &m_curves[(header[0] + ((uint)header[1] << 16)) * 4];
+    float pixel_x = (t[4] - t[0]) / (x1 - x0), pixel_y = (t[3] - t[1]) / (y1 - y0);
+    float y = t[1] + (py + 0.5f - y0) * pixel_y - cell_y * OUTLINE_CELL - 1.5f;
+    float x = t[0] + (px_min + 0.5f - x0) * pixel_x - cell_x * OUTLINE_CELL - 1.5f;
+
+    for(int px=px_min; px < px_max; px++, x += pixel_x){
+        float winding_x = 0.0f, winding_y = 0.0f, cx[3], cy[3];
+        for(uint i=0; i < header[2]; i++){
+            const uint16_t* c = &curves[i * 8];
+            for(uint j=0; j < 3; j++){
+                cx[j] = c[j * 2] * (1.0f / 65535.0f) - x;
+                cy[j] = c[j * 2 + 1] * (1.0f / 65535.0f) - y;
+            }
+            winding_x += outline_crossing(cy, cx, pixel_x);
+            winding_y += outline_crossing(cx, cy, pixel_y);
+        }
+        coverage[px - px_min] = std::min(0.5f * (std::fabs(winding_x) + std::fabs(winding_y)),
+                                         1.0f);
+    }
+}
+
+
+// blends the part of the glyph inside the rectangle, returns the number of pixels written
+size_t SoftwareBackend::drawGlyph(uint glyph, int x_min, int y_min, int x_max, int y_max){
+    const float* v = &m_vertices[glyph * 8];
+    const float* t = &m_tex_coords[glyph * 8];
+    const float* color = &m_colors[glyph * 16]; // same color in the 4 vertices
+    // bottom edge, the top one is moved by the shear of oblique styles (0 for the others)
+    float x0 = v[0] + m_disp[0], y0 = v[1] + m_disp[1], x1 = v[6] + m_disp[0], y1 = v[3] + m_disp[1];
+    float shear = (v[2] - v[0]) / (y1 - y0);
+    float coverage[SOFTWARE_TILE_SIZE];
+    size_t pixels = 0;
+    bool outline = t[0] >= OUTLINE_CELL; // see FontAtlas::loadOutlines
+
+    // rows whose center is inside the quad
+    int py_min = std::max(y_min, (int)std::ceil(y0 - 0.5f));
+    int py_max = std::min(y_max, (int)std::ceil(y1 - 0.5f));
+    if(x1 <= x0 || py_min >= py_max)
+        return 0;
+
+    // texel space, v goes down in the atlas while y goes up
+    float du = (t[4] - t[0]) * m_atlas_size / (x1 - x0);
+    float dv = (t[5] - t[1]) * m_atlas_size / (y1 - y0);
+    float v_pos = t[1] * m_atlas_size + (py_min + 0.5f - y0) * dv - 0.5f;
+
+#ifdef __SSE2__
+    const __m128 src = _mm_loadu_ps(color);
+    const __m128 to_unit = _mm_set1_ps(1.0f / 255.0f), to_byte = _mm_set1_ps(255.0f);
+    const __m128i zero = _mm_setzero_si128();
+#endif // __SSE2__
+
+    if(outline && !m_curves)
+        return 0;
+    for(int py=py_min; py < py_max; py++, v_pos += dv){
+        // pixels whose center is inside the quad on this row
+        float offset = (py + 0.5f - y0) * shear, row_x0 = x0 + offset, row_x1 = x1 + offset;
+        int px_min = std::max(x_min, (int)std::ceil(row_x0 - 0.5f));
+        int px_max = std::min(x_max, (int)std::ceil(row_x1 - 0.5f));
+        if(px_min >= px_max)
+            continue;
+
+        if(outline)
+            outlineCoverage(t, row_x0, row_x1, y0, y1, px_min, px_max, py, coverage);
+        else
+            atlasCoverage(t[0] * m_atlas_size + (px_min + 0.5f - row_x0) * du - 0.5f, du, v_pos,
+                          px_max - px_min, coverage);
+
+        unsigned char* dst = &m_pixels[(py * m_width + px_min) * 4];
+        for(int i=0; i < px_max - px_min; i++, dst += 4){
+            float alpha = coverage[i] * color[3];
+            if(alpha <= 0.0f)
+                continue;
+            pixels++;
+#ifdef __SSE2__
+            // the 4 channels at once: src * alpha + dst * (1 - alpha)
+            int packed;
+            std::memcpy(&packed, dst, 4);
+            __m128i dst_i = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero),
+                                               zero);
+            __m128 dst_f = _mm_mul_ps(_mm_cvtepi32_ps(dst_i), to_unit);
+            __m128 a = _mm_set1_ps(alpha);
+            __m128 out = _mm_add_ps(_mm_mul_ps(src, a),
+                                    _mm_mul_ps(dst_f, _mm_sub_ps(_mm_set1_ps(1.0f), a)));
+            __m128i out_i = _mm_cvtps_epi32(_mm_mul_ps(out, to_byte));
+            out_i = _mm_packus_epi16(_mm_packs_epi32(out_i, zero), zero);
+            packed = _mm_cvtsi128_si32(out_i);
+            std::memcpy(dst, &packed, 4);
+#else
+            for(uint c=0; c < 4; c++)
+                dst[c] = (color[c] * alpha + dst[c] * (1.0f / 255.0f) * (1.0f - alpha)) *
+                         255.0f + 0.5f;
+#endif // __SSE2__
+        }
+    }
+    return pixels;
+}
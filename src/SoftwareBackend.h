@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#ifndef SOFTWARE_BACKEND_H
+#define SOFTWARE_BACKEND_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "RenderBackend.h"
+
+
+// the framebuffer is split in tiles of this size, each one drawn by a single thread
+#define SOFTWARE_TILE_SIZE 64
+
+
+/*
+ * CPU rasterizer, doesn't need GL or a GPU. Blends the glyphs into an RGBA framebuffer the
+ * same way the example shader and glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) do, with
+ * bilinear sampling of the atlas, and draws the outline glyphs like the outline shader and
+ * the sheared quads of oblique styles (see FontAtlas::addStyle) as parallelograms. The
+ * atlas has to keep its pixels (no ATLAS_TEXTURE_DROP_CPU_COPY), LCD and distance field
+ * atlases are not supported.
+ */
+class SoftwareBackend : public RenderBackend{
+    private:
+        uint m_width, m_height;
+        uint m_num_threads;
+        std::vector<unsigned char> m_pixels; // RGBA, bottom row first like glReadPixels
+        std::vector<float> m_vertices, m_tex_coords, m_colors;
+
+        uint m_tiles_x, m_tiles_y;
+        std::vector<std::vector<uint>> m_tiles; // glyphs that overlap each tile, in order
+
+        // state of the current draw
+        const unsigned char* m_atlas;
+        uint m_atlas_size;
+        const uint16_t* m_curves;
+        float m_disp[2];
+
+        double m_draw_ms;
+        size_t m_pixels_drawn;
+
+        size_t drawTile(uint tile);
+        size_t drawGlyph(uint glyph, int x_min, int y_min, int x_max, int y_max);
+        void atlasCoverage(float u_pos, float du, float v_pos, int count, float* coverage) const;
+        void outlineCoverage(const float* t, float x0, float x1, float y0, float y1, int px_min,
+                             int px_max, int py, float* coverage) const;
+    public:
+        // 0 threads uses one per core
+        SoftwareBackend(uint width, uint height, uint num_threads);
+
+        void resize(uint width, uint height);
+        void clear(const float color[4]);
+        const unsigned char* getPixels() const;
+        uint getWidth() const;
+        uint getHeight() const;
+        size_t getPixelsDrawn() const; // blended in the last draw
+        bool savePPM(const char* path) const; // RGB, top row first
+
+        void setGeometry(const float* vertices, const float* tex_coords, const float* colors,
+                         uint num_glyphs, uint capacity);
+        void updateGeometry(uint first_glyph, const float* vertices, const float* tex_coords,
+                            const float* colors, uint num_glyphs);
+        void draw(const FontAtlas* atlas, const struct quad_range* ranges, uint num_ranges,
+                  const float disp[2]);
+        double getDrawTime() const;
+};
+
+
+#endif
@@ -17,79 +17,127 @@
 
 #include <string>
 #include <algorithm>
+#include <iterator>
 #include <iostream>
 #include <cstring>
+#include <cwchar>
 #include <cmath>
+#include <cstdint>
 #ifdef DEBUG
     #include <cassert>
 #endif // DEBUG
 
-#include <GL/glew.h>
-
 #include "Text2D.h"
+#include "TextBlob.h"
+#include "Bidi.h"
 #include "FontAtlas.h"
+#include "RenderBackend.h"
+#ifndef PTT_NO_GL
+    #include "GLBackend.h"
+#endif // PTT_NO_GL
 #include "common.h"
 
 
+#ifdef PTT_PROFILE
+static double elapsed_ms(const std::chrono::steady_clock::time_point& start,
+                         const std::chrono::steady_clock::time_point& end){
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+#endif // PTT_PROFILE
+
+
 Text2D::Text2D(){
     m_init = false;
+    m_backend = nullptr;
+    m_owns_backend = false;
+    m_num_cull_bands = 0;
+    m_num_line_bands = 0;
+    m_immediate_capacity = 0;
+    m_immediate_glyphs = 0;
+    m_frame = 0;
+    m_run_id = 0;
+    m_next_id = 0;
+    m_interned_sweep = INTERNED_SWEEP_MIN;
+    m_update_effects = false;
+    m_blob = nullptr;
+    m_blob_glyphs = 0;
+    m_atlas_generation = 0;
 }
 
 
+#ifndef PTT_NO_GL
 Text2D::Text2D(int fb_width, int fb_height, const FontAtlas* font, GLuint shader){
+    init(fb_width, fb_height, font);
+    m_backend = new GLBackend(shader);
+    m_owns_backend = true;
+}
+#endif // PTT_NO_GL
+
+
+Text2D::Text2D(int fb_width, int fb_height, const FontAtlas* font, RenderBackend* backend){
+#ifdef DEBUG
+    assert(backend);
+#endif // DEBUG
+    init(fb_width, fb_height, font);
+    m_backend = backend;
+    m_owns_backend = false;
+}
+
+
+void Text2D::init(int fb_width, int fb_height, const FontAtlas* font){
 #ifdef DEBUG
     assert(font);
 #endif // DEBUG
     m_font_atlas = font;
+    m_outline_scale = OUTLINE_MIN_SCALE;
+    m_layout_serial = 0;
     m_num_vertices = 0;
     m_num_indices = 0;
     m_fb_width = fb_width;
     m_fb_height = fb_height;
     m_update_buffer = true;
     m_init = true;
-    m_shader = shader;
     m_disp[0] = 0.0f;
     m_disp[1] = 0.0f;
 //    m_disp = math::vec2(0.0, 0.0);
-
-    initgl();
-}
-
-
-void Text2D::initgl(){
-    glGenVertexArrays(1, &m_vao);
-    glBindVertexArray(m_vao);
-
-    glGenBuffers(1, &m_vbo_vert);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vert);
-    glVertexAttribPointer(0, 2,  GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(0);
-
-    glGenBuffers(1, &m_vbo_tex);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_tex);
-    glVertexAttribPointer(1, 2,  GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(1);
-
-    glGenBuffers(1, &m_vbo_col);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_col);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(2);
-
-    glGenBuffers(1, &m_vbo_ind);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_vbo_ind);
-
-    m_disp_location = glGetUniformLocation(m_shader, "disp");
+    m_culling = false;
+    m_update_cull = true;
+    m_cull_rect[0] = 0.0f;
+    m_cull_rect[1] = 0.0f;
+    m_cull_rect[2] = fb_width;
+    m_cull_rect[3] = fb_height;
+    m_bands_origin = 0.0f;
+    m_cull_frame = 0;
+    m_num_cull_bands = 0;
+    m_hit_testing = false;
+    m_line_bands_origin = 0.0f;
+    m_num_line_bands = 0;
+    m_immediate_capacity = 0;
+    m_immediate_glyphs = 0;
+    m_frame = 0;
+    m_run_id = 0;
+    m_next_id = 0;
+    m_interned_sweep = INTERNED_SWEEP_MIN;
+    m_update_effects = false;
+    m_blob = nullptr;
+    m_blob_glyphs = 0;
+    m_atlas_generation = 0;
+#ifdef PTT_PROFILE
+    std::memset(&m_stats, 0, sizeof(struct text_stats));
+    m_stats_format = 0;
+    m_stats_first_event = true;
+    m_stats_epoch = std::chrono::steady_clock::now();
+#endif // PTT_PROFILE
 }
 
 
 Text2D::~Text2D(){
-    if(m_init){
-        glDeleteBuffers(1, &m_vbo_vert);
-        glDeleteBuffers(1, &m_vbo_tex);
-        glDeleteBuffers(1, &m_vbo_ind);
-        glDeleteBuffers(1, &m_vbo_col);
-        glDeleteVertexArrays(1, &m_vao);
-    }
+    if(m_owns_backend)
+        delete m_backend;
+#ifdef PTT_PROFILE
+    if(m_init && m_stats_dump.is_open() && m_stats_format == STATS_DUMP_TRACE)
+        m_stats_dump << "\n]" << std::endl;
+#endif // PTT_PROFILE
 }
 
 
@@ -133,119 +181,754 @@ void Text2D::getPenXY(float& pen_x, float& pen_y, struct string* string_){
 }
 
 
+const character* Text2D::layoutGlyph(wchar_t code, float& pen_x, float pen_y, float scale,
+                                     uint phases, uint font_style, float* vertices,
+                                     float* tex_coords) const{
+    const character* ch;
+    const struct glyph_outline* outline;
+    float w, h, xpos, ypos;
+
+    if(scale >= m_outline_scale && (outline = m_font_atlas->getOutline(code))){
+        m_font_atlas->getCharacter(code, 0, font_style, &ch);
+        if(!ch->style){ // the outlines are the ones of the normal glyphs
+            layoutOutline(*outline, pen_x, pen_y, scale, vertices, tex_coords);
+            advanceGlyph(*ch, pen_x, pen_y, scale, phases, font_style, vertices);
+            return ch;
+        }
+    }
+
+    if(phases > 1){
+        // the variant rendered closest to the fractional pen position, on a whole pixel
+        float pen_floor = std::floor(pen_x);
+        uint phase = (pen_x - pen_floor) * phases + 0.5f;
+        if(phase == phases){
+            pen_floor += 1.0f;
+            phase = 0;
+        }
+        m_font_atlas->getCharacter(code, phase, font_style, &ch);
+        if(ch->phase != phase) // no variant, round to the closest pixel
+            pen_floor = std::floor(pen_x + 0.5f);
+        xpos = pen_floor + (float)ch->bearing_x * scale;
+    }
+    else{
+        m_font_atlas->getCharacter(code, 0, font_style, &ch);
+        xpos = pen_x + (float)ch->bearing_x * scale;
+    }
+    ypos = pen_y - (float)(ch->height - ch->bearing_y) * scale;
+    w = (float)ch->width * scale;
+    h = (float)ch->height * scale;
+
+    vertices[0] = xpos;
+    vertices[1] = ypos;
+    vertices[2] = xpos;
+    vertices[3] = ypos + h;
+    vertices[4] = xpos + w;
+    vertices[5] = ypos + h;
+    vertices[6] = xpos + w;
+    vertices[7] = ypos;
+
+    tex_coords[0] = ch->tex_x_min;
+    tex_coords[1] = ch->tex_y_max;
+    tex_coords[2] = ch->tex_x_min;
+    tex_coords[3] = ch->tex_y_min;
+    tex_coords[4] = ch->tex_x_max;
+    tex_coords[5] = ch->tex_y_min;
+    tex_coords[6] = ch->tex_x_max;
+    tex_coords[7] = ch->tex_y_max;
+
+    advanceGlyph(*ch, pen_x, pen_y, scale, phases, font_style, vertices);
+    return ch;
+}
+
+
+// oblique styles shear the quad from the baseline, the texture follows as it's a parallelogram
+void Text2D::advanceGlyph(const character& ch, float& pen_x, float pen_y, float scale,
+                          uint phases, uint font_style, float* vertices) const{
+    const struct font_style* style;
+
+    if(font_style && (style = m_font_atlas->getStyle(font_style)) && style->oblique != 0.0f){
+        for(uint l=0; l < 8; l += 2)
+            vertices[l] += (vertices[l + 1] - pen_y) * style->oblique;
+    }
+    if(phases > 1)
+        pen_x += (float)ch.advance_x / 64.0f * scale;
+    else
+        pen_x += (float)(ch.advance_x >> 6) * scale;
+}
+
+
+// the outline is drawn at the exact pen position, a pixel around it is left for the antialiasing
+void Text2D::layoutOutline(const struct glyph_outline& outline, float pen_x, float pen_y,
+                           float scale, float* vertices, float* tex_coords) const{
+    float w = (outline.box[2] - outline.box[0]) * scale;
+    float h = (outline.box[3] - outline.box[1]) * scale;
+    float pad_x = std::min(1.0f / w, 0.5f), pad_y = std::min(1.0f / h, 0.5f);
+    float x0 = pen_x + outline.box[0] * scale - pad_x * w, x1 = x0 + (1.0f + 2.0f * pad_x) * w;
+    float y0 = pen_y + outline.box[1] * scale - pad_y * h, y1 = y0 + (1.0f + 2.0f * pad_y) * h;
+    float u = (outline.slot % OUTLINE_SLOTS_X + 1) * OUTLINE_CELL + 1.5f;
+    float v = (outline.slot / OUTLINE_SLOTS_X) * OUTLINE_CELL + 1.5f;
+
+    vertices[0] = x0;
+    vertices[1] = y0;
+    vertices[2] = x0;
+    vertices[3] = y1;
+    vertices[4] = x1;
+    vertices[5] = y1;
+    vertices[6] = x1;
+    vertices[7] = y0;
+
+    tex_coords[0] = u - pad_x;
+    tex_coords[1] = v - pad_y;
+    tex_coords[2] = u - pad_x;
+    tex_coords[3] = v + 1.0f + pad_y;
+    tex_coords[4] = u + 1.0f + pad_x;
+    tex_coords[5] = v + 1.0f + pad_y;
+    tex_coords[6] = u + 1.0f + pad_x;
+    tex_coords[7] = v - pad_y;
+}
+
+
+void Text2D::layoutLines(const wchar_t* text, const uint16_t* order, float scale,
+                         uint font_style, float width, float origin_x, float origin_y,
+                         float* vertices, float* tex_coords, float* pen_x) const{
+    uint phases = m_font_atlas->getSubpixelPhases(), k = 0, line = 0, start = 0, end;
+    float pen, pen_y = origin_y, line_height = getFontHeigth() * scale;
+    const character* ch;
+
+    while(true){
+        for(end=start; text[end] != '\0' && text[end] != '\n'; end++);
+        pen = origin_x;
+
+        if(!order){
+            for(uint j=start; j < end; j++){
+                if(pen_x)
+                    pen_x[j] = pen;
+                layoutGlyph(text[j], pen, pen_y, scale, phases, font_style,
+                            &vertices[(k + j - start) * 8], &tex_coords[(k + j - start) * 8]);
+            }
+        }
+        else if(end > start){
+            // right to left lines end at width, their advance is needed first
+            if(*order & BIDI_RTL_LINE){
+                float advance = 0.0f;
+                for(uint j=start; j < end; j++){
+                    m_font_atlas->getCharacter(text[j], 0, font_style, &ch);
+                    if(phases > 1)
+                        advance += (float)ch->advance_x / 64.0f * scale;
+                    else
+                        advance += (float)(ch->advance_x >> 6) * scale;
+                }
+                pen += std::max(std::floor(width - advance), 0.0f);
+            }
+            for(uint j=start; j < end; j++, order++){
+                uint offset = *order & BIDI_OFFSET_MASK;
+                wchar_t code = *order & BIDI_RTL ? bidi_mirror(text[offset]) : text[offset];
+                if(pen_x)
+                    pen_x[offset] = pen;
+                layoutGlyph(code, pen, pen_y, scale, phases, font_style,
+                            &vertices[(k + offset - start) * 8],
+                            &tex_coords[(k + offset - start) * 8]);
+            }
+        }
+        if(pen_x)
+            pen_x[end] = pen; // the line break, or the end
+        k += end - start;
+
+        if(text[end] == '\0')
+            break;
+        start = end + 1;
+        pen_y = origin_y - line_height * ++line;
+    }
+}
+
+
+void Text2D::layoutString(struct string_layout& layout) const{
+    layout.vertices.resize(layout.strlen * 8);
+    layout.tex_coords.resize(layout.strlen * 8);
+    layout.pen_x.resize(layout.text.size() + 1);
+    layoutLines(layout.text.c_str(), layout.bidi.empty() ? nullptr : layout.bidi.data(),
+                layout.scale, layout.font_style, layout.width, 0.0f, 0.0f,
+                layout.vertices.data(), layout.tex_coords.data(), layout.pen_x.data());
+    layout.generation = getLayoutGeneration();
+}
+
+
+void Text2D::writeString(struct string& str, float origin_x, float origin_y, bool effects,
+                         float* vertices, float* tex_coords, float* colors) const{
+    uint span = 0, k = 0; // k skips the line breaks
+    const float* color;
+
+    str.bounds[0] = str.bounds[1] = INFINITY;
+    str.bounds[2] = str.bounds[3] = -INFINITY;
+    if(!str.layout)
+        return;
+    const struct string_layout& layout = *str.layout;
+    for(uint j=0; j < layout.text.size(); j++){
+        if(layout.text[j] == '\n')
+            continue;
+
+        float* vertex = &vertices[k * 8];
+        float* tex_coord = &tex_coords[k * 8];
+        for(uint l=0; l < 8; l += 2){
+            vertex[l] = layout.vertices[k * 8 + l] + origin_x;
+            vertex[l + 1] = layout.vertices[k * 8 + l + 1] + origin_y;
+        }
+        std::memcpy(tex_coord, &layout.tex_coords[k * 8], sizeof(float) * 8);
+        if(str.effect && effects && tex_coord[0] < OUTLINE_CELL){
+            for(uint l=1; l < 8; l += 2)
+                tex_coord[l] += EFFECT_TEX_STRIDE * str.effect;
+        }
+
+        str.bounds[0] = std::min(str.bounds[0], vertex[0]);
+        str.bounds[1] = std::min(str.bounds[1], vertex[1]);
+        str.bounds[2] = std::max(str.bounds[2], vertex[4]);
+        str.bounds[3] = std::max(str.bounds[3], vertex[3]);
+
+        // spans are sorted, skip the ones that end before this character
+        while(span < str.spans.size() && str.spans[span].offset + str.spans[span].length <= j)
+            span++;
+        if(span < str.spans.size() && str.spans[span].offset <= j)
+            color = str.spans[span].color;
+        else
+            color = str.color;
+
+        for(uint l=0; l < 16; l += 4)
+            std::memcpy(&colors[k * 16 + l], color, sizeof(float) * 4);
+        k++;
+    }
+}
+
+
 void Text2D::updateBuffers(){
-    uint total_num_characters = 0, acc = 0;
-    std::unique_ptr<GLfloat[]> vertex_buffer;
-    std::unique_ptr<GLfloat[]> tex_coords_buffer;
-    std::unique_ptr<GLfloat[]> color_buffer;
-    std::unique_ptr<GLuint[]> index_buffer;
+#ifdef PTT_PROFILE
+    m_layout_start = std::chrono::steady_clock::now();
+#endif // PTT_PROFILE
+    uint total_num_characters = 0, acc = 0, generation = getLayoutGeneration();
+    bool effects = m_font_atlas->getSdfRendering();
+    uint capacity, buffer_glyphs;
+    float* vertex_buffer, *tex_coords_buffer, *color_buffer;
     for(uint i=0; i < m_strings.size(); i++)
         total_num_characters += m_strings.at(i).strlen;
 
-    m_num_vertices = total_num_characters * 4;
-    m_num_indices = total_num_characters * 6;
+    m_blob_glyphs = 0;
+    m_atlas_generation = m_font_atlas->getGeneration();
+    if(m_blob && m_blob->isValid(m_font_atlas))
+        m_blob_glyphs = m_blob->getGlyphCount();
+    else if(m_blob && m_blob->getGlyphCount())
+        std::cerr << "Text2D::updateBuffers: the blob comes from another atlas" << std::endl;
+
+    m_num_vertices = (total_num_characters + m_blob_glyphs) * 4;
+    m_num_indices = (total_num_characters + m_blob_glyphs) * 6;
+    // room for drawText after these
+    capacity = total_num_characters + m_blob_glyphs + m_immediate_capacity;
+    // a blob alone goes to the backend as it is
+    buffer_glyphs = total_num_characters ? total_num_characters + m_blob_glyphs : 0;
+
+    if(m_buffer_vertices.size() < 8 * buffer_glyphs){
+        m_buffer_vertices.resize(8 * buffer_glyphs);
+        m_buffer_tex.resize(8 * buffer_glyphs);
+        m_buffer_col.resize(16 * buffer_glyphs);
+    }
+    vertex_buffer = m_buffer_vertices.data();
+    tex_coords_buffer = m_buffer_tex.data();
+    color_buffer = m_buffer_col.data();
 
-    vertex_buffer.reset(new GLfloat[2 * m_num_vertices]);
-    tex_coords_buffer.reset(new GLfloat[2 * m_num_vertices]);
-    color_buffer.reset(new GLfloat[4 * m_num_vertices]);
-    index_buffer.reset(new GLuint[6 * total_num_characters]);
+    m_lines.clear();
+    m_glyph_x.clear();
+    m_glyph_order.clear();
+    m_string_lines.clear();
 
     for(uint i=0; i < m_strings.size(); i++){
         struct string* current_string = &m_strings.at(i);
-        float pen_x = current_string->posx, pen_y = current_string->posy, w, h, xpos, ypos;
-        uint index, index_color, disp;
-        const character* ch;
-        getPenXY(pen_x, pen_y, current_string);
-        uint j = 0, k = 0; // k is used to skip the possible line breaks
-        while(current_string->textbuffer[j] != '\0'){
-            if(current_string->textbuffer[j] == '\n'){
-                j++;
-                getPenXY(pen_x, pen_y, current_string);
-                pen_y -= (getFontHeigth() * current_string->scale) * (j - k);
+        struct string_layout* layout = current_string->layout.get();
+        float origin_x, origin_y, line_height = getFontHeigth() * current_string->scale;
+        uint line = 0;
+        // added on this thread, or laid out with another atlas, once for all its strings
+        if(layout && layout->generation != generation){
+            if(layout->measure_generation != m_font_atlas->getGeneration())
+                measureLayout(*layout, true);
+            layoutString(*layout);
+        }
+        if(layout){
+            current_string->width = layout->width;
+            current_string->height = layout->height;
+        }
+        getPenXY(origin_x, origin_y, current_string);
+        current_string->first_glyph = acc;
+        writeString(*current_string, origin_x, origin_y, effects, &vertex_buffer[acc * 8],
+                    &tex_coords_buffer[acc * 8], &color_buffer[acc * 16]);
+        if(m_hit_testing){
+            m_string_lines.push_back(m_lines.size());
+            beginLine(i, 0, origin_y, current_string->scale);
+            if(!layout){ // removed, or added by a batch not merged yet
+                m_glyph_x.push_back(origin_x);
                 continue;
             }
-
-            m_font_atlas->getCharacter(current_string->textbuffer[j], &ch);
-
-            xpos = pen_x + (float)ch->bearing_x * current_string->scale;
-            ypos = pen_y - (float)(ch->height - ch->bearing_y) * current_string->scale;
-            w = (float)ch->width * current_string->scale;
-            h = (float)ch->height * current_string->scale;
-
-            index = (k + acc) * 8;
-            vertex_buffer[index] = xpos;
-            vertex_buffer[index + 1] = ypos;
-            vertex_buffer[index + 2] = xpos;
-            vertex_buffer[index + 3] = ypos + h;
-            vertex_buffer[index + 4] = xpos + w;
-            vertex_buffer[index + 5] = ypos + h;
-            vertex_buffer[index + 6] = xpos + w;
-            vertex_buffer[index + 7] = ypos;
-
-            tex_coords_buffer[index] = ch->tex_x_min;
-            tex_coords_buffer[index + 1] = ch->tex_y_max;
-            tex_coords_buffer[index + 2] = ch->tex_x_min;
-            tex_coords_buffer[index + 3] = ch->tex_y_min;
-            tex_coords_buffer[index + 4] = ch->tex_x_max;
-            tex_coords_buffer[index + 5] = ch->tex_y_min;
-            tex_coords_buffer[index + 6] = ch->tex_x_max;
-            tex_coords_buffer[index + 7] = ch->tex_y_max;
-
-            index_color = (k + acc) * 16;
-            std::memcpy(&color_buffer[index_color], current_string->color, sizeof(GLfloat) * 4);
-            std::memcpy(&color_buffer[index_color + 4], current_string->color, sizeof(GLfloat) * 4);
-            std::memcpy(&color_buffer[index_color + 8], current_string->color, sizeof(GLfloat) * 4);
-            std::memcpy(&color_buffer[index_color + 12], current_string->color, sizeof(GLfloat) * 4);
-
-            disp = (k + acc) * 4;
-            index = (k + acc) * 6;
-            index_buffer[index] = disp;
-            index_buffer[index + 1] = disp + 2;
-            index_buffer[index + 2] = disp + 1;
-            index_buffer[index + 3] = disp;
-            index_buffer[index + 4] = disp + 3;
-            index_buffer[index + 5] = disp + 2;
-
-            pen_x += (float)(ch->advance_x >> 6) * current_string->scale;
-
-            j++;
-            k++;
+            const wchar_t* text = layout->text.c_str();
+            const uint16_t* order = layout->bidi.data();
+            uint j;
+            for(j=0; text[j] != '\0'; j++){
+                if(text[j] != '\n' && layout->bidi.size()){ // one line at a time
+                    uint first = j;
+                    m_lines.back().first_order = m_glyph_order.size();
+                    for(; text[j] != '\0' && text[j] != '\n'; j++, order++){
+                        uint offset = *order & BIDI_OFFSET_MASK;
+                        m_glyph_x.push_back(origin_x + layout->pen_x[offset]);
+                        m_glyph_order.push_back((offset - first) | (*order & BIDI_RTL));
+                    }
+                    m_lines.back().count = j - first;
+                    if(text[j] == '\0')
+                        break;
+                }
+                m_glyph_x.push_back(origin_x + layout->pen_x[j]);
+                if(text[j] == '\n')
+                    beginLine(i, j + 1, origin_y - line_height * ++line, current_string->scale);
+                else
+                    m_lines.back().count++;
+            }
+            m_glyph_x.push_back(origin_x + layout->pen_x[j]);
         }
         acc += current_string->strlen;
     }
 
-    glBindVertexArray(m_vao);
+#ifdef PTT_PROFILE
+    m_upload_start = std::chrono::steady_clock::now();
+#endif // PTT_PROFILE
+    if(!buffer_glyphs && m_blob_glyphs){
+        m_backend->setGeometry(m_blob->getVertices(), m_blob->getTexCoords(),
+                               m_blob->getColors(), m_blob_glyphs, capacity);
+    }
+    else{
+        if(m_blob_glyphs){
+            std::memcpy(&vertex_buffer[acc * 8], m_blob->getVertices(),
+                        sizeof(float) * 8 * m_blob_glyphs);
+            std::memcpy(&tex_coords_buffer[acc * 8], m_blob->getTexCoords(),
+                        sizeof(float) * 8 * m_blob_glyphs);
+            std::memcpy(&color_buffer[acc * 16], m_blob->getColors(),
+                        sizeof(float) * 16 * m_blob_glyphs);
+        }
+        m_backend->setGeometry(vertex_buffer, tex_coords_buffer, color_buffer, buffer_glyphs,
+                               capacity);
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vert);
-    glBufferData(GL_ARRAY_BUFFER, 2 * m_num_vertices * sizeof(GLfloat), vertex_buffer.get(), GL_STATIC_DRAW);
+#ifdef PTT_PROFILE
+    std::chrono::steady_clock::time_point upload_end = std::chrono::steady_clock::now();
+#endif // PTT_PROFILE
+
+    buildCullBands();
+    if(m_hit_testing)
+        buildLineBands();
+    m_last_immediate.clear(); // the immediate mode glyphs have to be uploaded again
+
+#ifdef PTT_PROFILE
+    size_t bytes = 8 * m_num_vertices * sizeof(float);
+    m_stats.upload_ms = elapsed_ms(m_upload_start, upload_end);
+    m_stats.layout_ms = elapsed_ms(m_layout_start, std::chrono::steady_clock::now()) -
+                        m_stats.upload_ms;
+    m_stats.rebuilds++;
+    m_stats.glyphs = total_num_characters + m_blob_glyphs;
+    m_stats.bytes_uploaded += bytes;
+    m_stats.total_bytes_uploaded += bytes;
+#endif // PTT_PROFILE
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_tex);
-    glBufferData(GL_ARRAY_BUFFER, 2 * m_num_vertices * sizeof(GLfloat), tex_coords_buffer.get(), GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_col);
-    glBufferData(GL_ARRAY_BUFFER, 4 * m_num_vertices * sizeof(GLfloat), color_buffer.get(), GL_STATIC_DRAW);
+void Text2D::beginLine(uint string, uint offset, float pen_y, float scale){
+    struct glyph_line line;
+    float ascender = (m_font_atlas->getAscender() >> 6) * scale;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_vbo_ind);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * total_num_characters * sizeof(GLuint), index_buffer.get(), GL_STATIC_DRAW);
+    line.string = string;
+    line.first_offset = offset;
+    line.first_x = m_glyph_x.size();
+    line.first_order = TEXT_LINE_NOT_REORDERED;
+    line.count = 0;
+    line.y_max = pen_y + ascender;
+    line.y_min = line.y_max - getFontHeigth() * scale;
+    m_lines.push_back(line);
+}
+
+
+// empties the bands in use and makes room for count of them, keeping the memory of all of them
+static void resetBands(std::vector<std::vector<uint>>& bands, uint& num_bands, uint count){
+    for(uint i=0; i < num_bands; i++)
+        bands[i].clear();
+    if(bands.size() < count)
+        bands.resize(count);
+    num_bands = count;
+}
+
+
+void Text2D::buildLineBands(){
+    float y_min = INFINITY, y_max = -INFINITY;
+    uint first, last;
+
+    for(uint i=0; i < m_lines.size(); i++){
+        y_min = std::min(y_min, m_lines[i].y_min);
+        y_max = std::max(y_max, m_lines[i].y_max);
+    }
+    resetBands(m_line_bands, m_num_line_bands,
+               y_min > y_max ? 0 : (uint)((y_max - y_min) / CULL_BAND_HEIGHT) + 1);
+    if(!m_num_line_bands)
+        return;
+
+    m_line_bands_origin = y_min;
+    for(uint i=0; i < m_lines.size(); i++){
+        first = (m_lines[i].y_min - m_line_bands_origin) / CULL_BAND_HEIGHT;
+        last = (m_lines[i].y_max - m_line_bands_origin) / CULL_BAND_HEIGHT;
+        for(uint j=first; j <= last && j < m_num_line_bands; j++)
+            m_line_bands[j].push_back(i);
+    }
+}
+
+
+void Text2D::setHitTesting(bool hit_testing){
+    if(hit_testing && !m_hit_testing)
+        m_update_buffer = true;
+    m_hit_testing = hit_testing;
+}
+
+
+bool Text2D::hitTest(float x, float y, uint& string, uint& offset){
+    const float* begin, *end, *it;
+    int band;
+
+    if(!m_hit_testing)
+        return false;
+    if(m_update_buffer){
+        updateBuffers();
+        m_update_buffer = false;
+    }
+
+    x -= m_disp[0];
+    y -= m_disp[1];
+    band = std::floor((y - m_line_bands_origin) / CULL_BAND_HEIGHT);
+    if(band < 0 || band >= (int)m_num_line_bands)
+        return false;
+
+    // the last string added is drawn on top, so it wins
+    for(int i=m_line_bands[band].size() - 1; i >= 0; i--){
+        const struct glyph_line& line = m_lines[m_line_bands[band][i]];
+
+        if(y < line.y_min || y > line.y_max || !line.count)
+            continue;
+        begin = &m_glyph_x[line.first_x];
+        end = begin + line.count + 1;
+        if(x < begin[0] || x >= end[-1])
+            continue;
+
+        it = std::upper_bound(begin, end, x);
+        string = line.string;
+        offset = it - begin - 1; // visual position in the line
+        if(line.first_order != TEXT_LINE_NOT_REORDERED)
+            offset = m_glyph_order[line.first_order + offset] & BIDI_OFFSET_MASK;
+        offset += line.first_offset;
+        return true;
+    }
+    return false;
+}
+
+
+// line that contains the offset, the line break belongs to the line it ends
+const struct Text2D::glyph_line* Text2D::findLine(uint string, uint offset){
+    std::vector<struct glyph_line>::const_iterator first, last, it;
+
+    if(!m_hit_testing || string >= m_strings.size())
+        return nullptr;
+    if(m_update_buffer){
+        updateBuffers();
+        m_update_buffer = false;
+    }
+
+    first = m_lines.begin() + m_string_lines[string];
+    last = string + 1 < m_string_lines.size() ? m_lines.begin() + m_string_lines[string + 1] :
+                                                m_lines.end();
+    it = std::upper_bound(first, last, offset, [](uint value, const glyph_line& line){
+                              return value < line.first_offset;
+                          });
+
+    const struct glyph_line& line = *(it - 1);
+    if(offset - line.first_offset > line.count)
+        return nullptr;
+    return &line;
+}
+
+
+// position in m_glyph_x of a character of a line, from its offset in the line
+uint Text2D::visualIndex(const struct glyph_line& line, uint offset) const{
+    if(line.first_order == TEXT_LINE_NOT_REORDERED)
+        return offset;
+    for(uint i=0; i < line.count; i++){
+        if((m_glyph_order[line.first_order + i] & BIDI_OFFSET_MASK) == offset)
+            return i;
+    }
+    return line.count;
+}
+
+
+bool Text2D::getCaretRect(uint string, uint offset, struct text_rect& rect){
+    const struct glyph_line* line = findLine(string, offset);
+    uint index;
+
+    if(!line)
+        return false;
+    offset -= line->first_offset;
+    if(line->first_order == TEXT_LINE_NOT_REORDERED || !line->count){
+        index = offset;
+    }
+    else{
+        // before a character on its leading side, the end of the line after the last one
+        bool end = offset == line->count;
+        index = visualIndex(*line, end ? offset - 1 : offset);
+        if(((m_glyph_order[line->first_order + index] & BIDI_RTL) != 0) != end)
+            index++;
+    }
+
+    rect.x = m_glyph_x[line->first_x + index] + m_disp[0];
+    rect.y = line->y_min + m_disp[1];
+    rect.width = 0.0f;
+    rect.height = line->y_max - line->y_min;
+    return true;
+}
+
+
+bool Text2D::getCharacterRect(uint string, uint offset, struct text_rect& rect){
+    const struct glyph_line* line = findLine(string, offset);
+    uint index;
+
+    if(!line || offset - line->first_offset >= line->count) // line break or end
+        return false;
+    index = line->first_x + visualIndex(*line, offset - line->first_offset);
+
+    rect.x = m_glyph_x[index] + m_disp[0];
+    rect.y = line->y_min + m_disp[1];
+    rect.width = m_glyph_x[index + 1] - m_glyph_x[index];
+    rect.height = line->y_max - line->y_min;
+    return true;
+}
+
+
+void Text2D::buildCullBands(){
+    float y_min = INFINITY, y_max = -INFINITY;
+    uint first, last;
+
+    for(uint i=0; i < m_strings.size(); i++){
+        if(!m_strings[i].strlen)
+            continue;
+        y_min = std::min(y_min, m_strings[i].bounds[1]);
+        y_max = std::max(y_max, m_strings[i].bounds[3]);
+    }
+
+    resetBands(m_cull_bands, m_num_cull_bands,
+               y_min > y_max ? 0 : (uint)((y_max - y_min) / CULL_BAND_HEIGHT) + 1);
+    m_cull_stamp.assign(m_strings.size(), 0);
+    m_cull_frame = 0;
+    m_update_cull = true;
+    if(!m_num_cull_bands)
+        return;
+
+    m_bands_origin = y_min;
+
+    for(uint i=0; i < m_strings.size(); i++){
+        if(!m_strings[i].strlen)
+            continue;
+        first = (m_strings[i].bounds[1] - m_bands_origin) / CULL_BAND_HEIGHT;
+        last = (m_strings[i].bounds[3] - m_bands_origin) / CULL_BAND_HEIGHT;
+        for(uint j=first; j <= last && j < m_num_cull_bands; j++)
+            m_cull_bands[j].push_back(i);
+    }
+}
+
+
+void Text2D::updateVisibleRanges(){
+    // cull rectangle in the same space as the vertices
+    float x_min = m_cull_rect[0] - m_disp[0], x_max = x_min + m_cull_rect[2];
+    float y_min = m_cull_rect[1] - m_disp[1], y_max = y_min + m_cull_rect[3];
+    int first, last;
+
+    m_visible.clear();
+    m_ranges.clear();
+    m_cull_frame++;
+
+    first = std::floor((y_min - m_bands_origin) / CULL_BAND_HEIGHT);
+    last = std::floor((y_max - m_bands_origin) / CULL_BAND_HEIGHT);
+    first = std::max(first, 0);
+    last = std::min(last, (int)m_num_cull_bands - 1);
+
+    for(int i=first; i <= last; i++){
+        for(uint j=0; j < m_cull_bands[i].size(); j++){
+            uint index = m_cull_bands[i][j];
+            const struct string& str = m_strings[index];
+
+            if(m_cull_stamp[index] == m_cull_frame)
+                continue;
+            m_cull_stamp[index] = m_cull_frame;
+
+            if(str.bounds[2] >= x_min && str.bounds[0] <= x_max &&
+               str.bounds[3] >= y_min && str.bounds[1] <= y_max)
+                m_visible.push_back(index);
+        }
+    }
+    std::sort(m_visible.begin(), m_visible.end());
+
+    // merge consecutive strings into a single range of quads
+    uint next_glyph = 0;
+    for(uint i=0; i < m_visible.size(); i++){
+        const struct string& str = m_strings[m_visible[i]];
+
+        if(m_ranges.size() && next_glyph == str.first_glyph){
+            m_ranges.back().count += str.strlen;
+        }
+        else{
+            struct quad_range range = {str.first_glyph, str.strlen};
+            m_ranges.push_back(range);
+        }
+        next_glyph = str.first_glyph + str.strlen;
+    }
+    if(m_blob_glyphs){
+        const float* bounds = m_blob->getBounds();
+        struct quad_range range = {m_num_indices / 6 - m_blob_glyphs, m_blob_glyphs};
+
+        if(bounds[2] >= x_min && bounds[0] <= x_max && bounds[3] >= y_min && bounds[1] <= y_max){
+            if(m_ranges.size() && next_glyph == range.first)
+                m_ranges.back().count += range.count;
+            else
+                m_ranges.push_back(range);
+        }
+    }
+    m_update_cull = false;
 }
 
 
 void Text2D::render(){
+#ifdef PTT_PROFILE
+    m_stats.bytes_uploaded = 0;
+#ifdef PTT_ALLOC_COUNTER
+    unsigned long allocations = alloc_count();
+#endif // PTT_ALLOC_COUNTER
+#endif // PTT_PROFILE
+    mergeBatches();
+    // the atlas was rebuilt (see FontAtlas::swapRebaked), the text is measured and laid out again
+    if(m_atlas_generation != m_font_atlas->getGeneration())
+        m_update_buffer = true;
+#ifdef PTT_PROFILE
+    bool rebuilt = m_update_buffer;
+#endif // PTT_PROFILE
     if(m_update_buffer){
         updateBuffers();
         m_update_buffer = false;
     }
-    glUseProgram(m_shader);
-    glBindVertexArray(m_vao);
+    if(m_update_effects){
+        m_backend->setEffects(m_effects.data(), m_effects.size());
+        m_update_effects = false;
+    }
+    if(m_immediate.size() || m_immediate_glyphs)
+        updateImmediate();
+
+    if(m_update_cull){
+        if(m_culling)
+            updateVisibleRanges();
+        else{
+            struct quad_range range = {0, m_num_indices / 6};
+            m_ranges.assign(1, range);
+            m_update_cull = false;
+        }
+    }
+    // the immediate mode glyphs go after the strings
+    uint num_ranges = m_ranges.size();
+    if(m_immediate_glyphs){
+        struct quad_range range = {m_num_indices / 6, m_immediate_glyphs};
+        m_ranges.push_back(range);
+    }
+    m_backend->draw(m_font_atlas, m_ranges.data(), m_ranges.size(), m_disp);
+
+#ifdef PTT_PROFILE
+    m_stats.drawn_glyphs = 0;
+    for(uint i=0; i < m_ranges.size(); i++)
+        m_stats.drawn_glyphs += m_ranges[i].count;
+    m_stats.draw_ms = m_backend->getDrawTime();
+    m_stats.frames++;
+#ifdef PTT_ALLOC_COUNTER
+    m_stats.allocations = alloc_count() - allocations;
+#endif // PTT_ALLOC_COUNTER
+    if(m_stats_dump.is_open())
+        dumpFrameStats(rebuilt);
+#endif // PTT_PROFILE
+    m_ranges.resize(num_ranges);
+}
 
-    glUniform2f(m_disp_location, m_disp[0], m_disp[1]);
 
-    m_font_atlas->bindTexture();
-    glDrawElements(GL_TRIANGLES, m_num_indices, GL_UNSIGNED_INT, NULL);
+void Text2D::getStats(struct text_stats& stats) const{
+#ifdef PTT_PROFILE
+    stats = m_stats;
+#else
+    std::memset(&stats, 0, sizeof(struct text_stats));
+#endif // PTT_PROFILE
 }
 
 
-void Text2D::addString(const wchar_t* string, float relative_x, 
+bool Text2D::setStatsDump(const char* path, int format){
+#ifdef PTT_PROFILE
+#ifdef DEBUG
+    assert(format == STATS_DUMP_CSV || format == STATS_DUMP_TRACE);
+#endif // DEBUG
+    if(m_stats_dump.is_open() && m_stats_format == STATS_DUMP_TRACE)
+        m_stats_dump << "\n]" << std::endl;
+    m_stats_dump.close();
+    m_stats_dump.open(path);
+    if(!m_stats_dump.is_open()){
+        std::cerr << "Text2D::setStatsDump: can't open " << path << std::endl;
+        return false;
+    }
+    m_stats_format = format;
+    m_stats_first_event = true;
+    if(format == STATS_DUMP_CSV)
+        m_stats_dump << "frame,rebuilt,glyphs,drawn_glyphs,bytes_uploaded,layout_ms,upload_ms,"
+                        "draw_ms" << std::endl;
+    else
+        m_stats_dump << "[";
+    return true;
+#else
+    UNUSED(path);
+    UNUSED(format);
+    std::cerr << "Text2D::setStatsDump: built without PTT_PROFILE (make PROFILE=1)" << std::endl;
+    return false;
+#endif // PTT_PROFILE
+}
+
+
+#ifdef PTT_PROFILE
+void Text2D::dumpFrameStats(bool rebuilt){
+    if(m_stats_format == STATS_DUMP_CSV){
+        m_stats_dump << m_stats.frames << ',' << rebuilt << ',' << m_stats.glyphs << ','
+                     << m_stats.drawn_glyphs << ',' << m_stats.bytes_uploaded << ','
+                     << (rebuilt ? m_stats.layout_ms : 0.0) << ','
+                     << (rebuilt ? m_stats.upload_ms : 0.0) << ',' << m_stats.draw_ms << '\n';
+        return;
+    }
+
+    // trace events, timestamps and durations in microseconds
+    if(rebuilt){
+        m_stats_dump << (m_stats_first_event ? "\n" : ",\n")
+                     << "{\"name\":\"updateBuffers\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+                     << elapsed_ms(m_stats_epoch, m_layout_start) * 1000.0 << ",\"dur\":"
+                     << (m_stats.layout_ms + m_stats.upload_ms) * 1000.0 << "},\n"
+                     << "{\"name\":\"upload\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+                     << elapsed_ms(m_stats_epoch, m_upload_start) * 1000.0 << ",\"dur\":"
+                     << m_stats.upload_ms * 1000.0 << ",\"args\":{\"bytes\":"
+                     << m_stats.bytes_uploaded << "}}";
+        m_stats_first_event = false;
+    }
+    m_stats_dump << (m_stats_first_event ? "\n" : ",\n")
+                 << "{\"name\":\"text\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+                 << elapsed_ms(m_stats_epoch, std::chrono::steady_clock::now()) * 1000.0
+                 << ",\"args\":{\"drawn_glyphs\":" << m_stats.drawn_glyphs
+                 << ",\"draw_ms\":" << m_stats.draw_ms << "}}";
+    m_stats_first_event = false;
+}
+#endif // PTT_PROFILE
+
+
+uint Text2D::addString(const wchar_t* string, float relative_x, 
                        float relative_y, float scale, int alignment, float color[3]){
 #ifdef DEBUG
     assert(color);
@@ -259,17 +942,180 @@ void Text2D::addString(const wchar_t* string, float relative_x,
 #endif // DEBUG
     uint i;
 
-    addString(string, 0, 0, scale, STRING_DRAW_RELATIVE, alignment, color);
+    i = addString(string, 0, 0, scale, STRING_DRAW_RELATIVE, alignment, color);
 
     // dirty dirty...
-    i = m_strings.size();
-    struct string& str = m_strings.at(i-1);
+    struct string& str = m_strings.at(i);
     str.relative_x = relative_x;
     str.relative_y = relative_y;
+
+    return i;
 }
 
 
-void Text2D::addString(const wchar_t* text, uint x, uint y, 
+static void initString(struct string& str, uint x, uint y, float scale, int placement,
+                       int alignment, const float color[4]){
+    str.posx = x;
+    str.posy = y;
+    str.scale = scale;
+    str.placement = placement;
+    str.alignment = alignment;
+    std::memcpy(str.color, color, sizeof(float) * 4);
+}
+
+
+bool span_comparator(const string_span& a, const string_span& b){
+    return a.offset < b.offset;
+}
+
+
+static void setSpans(struct string& str, const struct string_span* spans, uint num_spans){
+#ifdef DEBUG
+    assert(spans || !num_spans);
+#endif // DEBUG
+    str.spans.assign(spans, spans + num_spans);
+    std::sort(str.spans.begin(), str.spans.end(), span_comparator);
+}
+
+
+void Text2D::setText(struct string& str, const wchar_t* text, bool cached){
+    std::unordered_map<size_t, std::shared_ptr<struct string_layout>>::iterator it;
+    size_t hash = 14695981039346656037ULL; // FNV-1a over the characters, scale and style
+    uint len = 0, scale_bits;
+    bool in_place = false;
+
+    while(text[len] != '\0' && len < STRING_MAX_LEN - 1){
+        hash = (hash ^ (size_t)text[len]) * 1099511628211ULL;
+        len++;
+    }
+    std::memcpy(&scale_bits, &str.scale, sizeof(scale_bits));
+    hash = (hash ^ scale_bits) * 1099511628211ULL;
+    hash = (hash ^ str.font_style) * 1099511628211ULL;
+
+    if(cached){
+        it = m_interned.find(hash);
+        if(it != m_interned.end() && it->second->scale == str.scale &&
+           it->second->font_style == str.font_style &&
+           !it->second->text.compare(0, std::wstring::npos, text, len)){
+            if(str.layout != it->second){
+                releaseLayout(str);
+                str.layout = it->second;
+            }
+            if(str.layout->measure_generation != m_font_atlas->getGeneration())
+                measureLayout(*str.layout, true); // kept in the table across a rebake
+            str.strlen = str.layout->strlen;
+            str.width = str.layout->width;
+            str.height = str.layout->height;
+            return;
+        }
+        /* Nobody else uses the layout, it takes the new text with the memory it has. It
+         * leaves the table, as inserting it again would allocate, so text that changes every
+         * frame is neither shared nor measured through the cache of the atlas. */
+        if(str.layout){
+            it = m_interned.find(str.layout->hash);
+            in_place = str.layout.use_count() == 1 ||
+                       (str.layout.use_count() == 2 && it != m_interned.end() &&
+                        it->second == str.layout);
+            if(in_place && str.layout.use_count() == 2)
+                m_interned.erase(it);
+        }
+    }
+
+    if(!in_place)
+        newLayout(str, cached);
+    struct string_layout& layout = *str.layout;
+    layout.text.assign(text, len);
+    layout.scale = str.scale;
+    layout.font_style = str.font_style;
+    layout.hash = hash;
+    measureLayout(layout, cached && !in_place);
+    str.width = layout.width;
+    str.height = layout.height;
+    str.strlen = layout.strlen;
+    bidi_reorder(layout.text.c_str(), layout.bidi);
+    layout.generation = 0;
+    if(cached && !in_place)
+        internLayout(str);
+}
+
+
+void Text2D::measureLayout(struct string_layout& layout, bool cached) const{
+    static thread_local struct text_metrics uncached; // keeps the memory of the advances
+    const text_metrics* metrics;
+
+    if(cached){
+        m_font_atlas->measure(layout.text.c_str(), layout.scale, &metrics, layout.font_style);
+    }
+    else{ // other threads can't use the cache
+        m_font_atlas->measure(layout.text.c_str(), layout.scale, uncached, layout.font_style);
+        metrics = &uncached;
+    }
+    layout.width = metrics->width;
+    layout.height = metrics->height;
+    layout.strlen = metrics->advances.size() - (metrics->lines - 1);
+    layout.measure_generation = m_font_atlas->getGeneration();
+}
+
+
+void Text2D::internLayout(struct string& str){
+#ifdef DEBUG
+    assert(str.layout);
+#endif // DEBUG
+    if(m_interned.size() >= m_interned_sweep)
+        sweepLayouts();
+
+    std::pair<std::unordered_map<size_t, std::shared_ptr<struct string_layout>>::iterator,
+              bool> result = m_interned.insert(std::make_pair(str.layout->hash, str.layout));
+    const struct string_layout& other = *result.first->second;
+
+    // a hash collision keeps its own layout, and takes the place of an unused one
+    if(!result.second && other.scale == str.layout->scale &&
+       other.font_style == str.layout->font_style && other.text == str.layout->text)
+        str.layout = result.first->second;
+    else if(!result.second && result.first->second.use_count() == 1)
+        result.first->second = str.layout;
+}
+
+
+void Text2D::sweepLayouts(){
+    std::unordered_map<size_t, std::shared_ptr<struct string_layout>>::iterator it;
+
+    it = m_interned.begin();
+    while(it != m_interned.end()){
+        if(it->second.use_count() == 1){
+            if(m_spare_layouts.size() < SPARE_LAYOUTS_MAX)
+                m_spare_layouts.push_back(std::move(it->second));
+            it = m_interned.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+    m_interned_sweep = std::max((size_t)INTERNED_SWEEP_MIN, m_interned.size() * 2);
+}
+
+
+void Text2D::releaseLayout(struct string& str){
+    if(!str.layout)
+        return;
+    if(str.layout.use_count() == 1 && m_spare_layouts.size() < SPARE_LAYOUTS_MAX)
+        m_spare_layouts.push_back(std::move(str.layout));
+    str.layout.reset();
+}
+
+
+void Text2D::newLayout(struct string& str, bool cached){
+    if(cached && m_spare_layouts.size()){ // other threads can't take them
+        str.layout = std::move(m_spare_layouts.back());
+        m_spare_layouts.pop_back();
+    }
+    else{
+        str.layout = std::make_shared<struct string_layout>();
+    }
+}
+
+
+uint Text2D::addString(const wchar_t* text, uint x, uint y, 
                        float scale, int placement, int alignment, float color[4]){
 #ifdef DEBUG
     assert(color);
@@ -277,55 +1123,436 @@ void Text2D::addString(const wchar_t* text, uint x, uint y,
     assert(alignment > 0);
     assert(alignment < 6);
 #endif
-    const character* ch;
-    uint i = m_strings.size(), j = 0, w = 0;
+    uint i = m_next_id++;
 
-    m_strings.push_back(string());
+    if(m_strings.size() <= i) // the indices in between may belong to batches not merged yet
+        m_strings.resize(i + 1);
     struct string& str = m_strings.at(i);
 
+    initString(str, x, y, scale, placement, alignment, color);
+    setText(str, text, true);
+
+    m_update_buffer = true;
+
+    return i;
+}
+
+
+void Text2D::updateString(uint index, const wchar_t* text, uint x, uint y){
+#ifdef DEBUG
+    assert(text);
+    assert(index < m_strings.size());
+#endif // DEBUG
+    struct string& str = m_strings.at(index);
+
     str.posx = x;
     str.posy = y;
-    str.scale = scale;
-    str.placement = placement;
-    str.alignment = alignment;
-    str.width = 0;
-    str.height = getFontHeigth() * scale;
-    std::memcpy(str.color, color, sizeof(float) * 4);
-    wstrcpy(str.textbuffer, text, STRING_MAX_LEN);
+    setText(str, text, true);
 
-    str.strlen = 0;
-    while(str.textbuffer[j] != '\0' && j <= STRING_MAX_LEN){
-        j++;
+    m_update_buffer = true;
+}
 
-        m_font_atlas->getCharacter(str.textbuffer[j], &ch);
-        w += (float)(ch->advance_x >> 6) * scale;
 
-        if(str.textbuffer[j] != '\n'){
-            str.strlen++;
+void Text2D::setStringEffect(uint index, const struct text_effect* effect){
+#ifdef DEBUG
+    assert(index < m_strings.size());
+#endif // DEBUG
+    uint i = 0;
+
+    if(effect){
+        while(i < m_effects.size() && std::memcmp(&m_effects[i], effect, sizeof(*effect)))
+            i++;
+        if(i == TEXT_MAX_EFFECTS){
+            std::cerr << "Text2D::setStringEffect: more than " << TEXT_MAX_EFFECTS
+                      << " effects" << std::endl;
+            return;
         }
-        else{
-            str.height += getFontHeigth() * scale;
-            if(str.width < w){
-                str.width = w;
-            }
-            w = 0;
+        if(i == m_effects.size()){
+            m_effects.push_back(*effect);
+            m_update_effects = true;
         }
+        i++;
     }
-    if(str.width < w){
-        str.width = w;
+    m_strings.at(index).effect = i;
+    m_update_buffer = true;
+}
+
+
+void Text2D::setStringStyle(uint index, uint font_style){
+#ifdef DEBUG
+    assert(index < m_strings.size());
+#endif // DEBUG
+    struct string& str = m_strings.at(index);
+
+    if(str.font_style == font_style)
+        return;
+    str.font_style = font_style;
+    if(str.layout){
+        std::wstring text = str.layout->text; // setText may reuse the layout
+        setText(str, text.c_str(), true);
     }
+    m_update_buffer = true;
+}
+
+
+void Text2D::removeString(uint index){
+#ifdef DEBUG
+    assert(index < m_strings.size());
+#endif // DEBUG
+    struct string& str = m_strings.at(index);
+
+    releaseLayout(str);
+    str.strlen = 0;
+    str.width = 0;
+    str.height = 0;
+    str.spans.clear();
+    str.effect = 0;
+    str.font_style = 0;
 
     m_update_buffer = true;
 }
 
 
+uint Text2D::addString(const wchar_t* text, uint x, uint y, float scale, int placement,
+                       int alignment, float color[4], const struct string_span* spans,
+                       uint num_spans){
+    uint i = addString(text, x, y, scale, placement, alignment, color);
+
+    setSpans(m_strings.at(i), spans, num_spans);
+
+    return i;
+}
+
+
+uint Text2D::addString(const wchar_t* text, float relative_x, float relative_y,
+                       float scale, int alignment, float color[4],
+                       const struct string_span* spans, uint num_spans){
+    uint i = addString(text, relative_x, relative_y, scale, alignment, color);
+
+    setSpans(m_strings.at(i), spans, num_spans);
+
+    return i;
+}
+
+
+void Text2D::drawText(float x, float y, const wchar_t* text, const struct text_style& style){
+#ifdef DEBUG
+    assert(text);
+#endif // DEBUG
+    size_t hash = 14695981039346656037ULL; // FNV-1a over the characters and the style
+    uint len = 0, scale_bits;
+    struct immediate_text item;
+
+    while(text[len] != '\0'){
+        hash = (hash ^ (size_t)text[len]) * 1099511628211ULL;
+        len++;
+    }
+    std::memcpy(&scale_bits, &style.scale, sizeof(scale_bits));
+    hash = (hash ^ scale_bits) * 1099511628211ULL;
+    hash = (hash ^ (size_t)style.alignment) * 1099511628211ULL;
+    hash = (hash ^ style.font_style) * 1099511628211ULL;
+
+    std::unordered_map<size_t, struct glyph_run>::iterator it = m_layout_cache.find(hash);
+    // on a collision with a run drawn in this frame try the next slot, otherwise overwrite it
+    while(it != m_layout_cache.end() && it->second.last_frame == m_frame &&
+          !(it->second.scale == style.scale && it->second.alignment == style.alignment &&
+            it->second.font_style == style.font_style &&
+            it->second.text.compare(0, std::wstring::npos, text, len) == 0))
+        it = m_layout_cache.find(++hash);
+
+    if(it == m_layout_cache.end() || it->second.scale != style.scale || 
+       it->second.alignment != style.alignment || it->second.font_style != style.font_style ||
+       it->second.generation != getLayoutGeneration() ||
+       it->second.text.compare(0, std::wstring::npos, text, len) != 0){
+        struct glyph_run& run = m_layout_cache[hash];
+        run.text.assign(text, len);
+        run.scale = style.scale;
+        run.alignment = style.alignment;
+        run.font_style = style.font_style;
+        run.id = ++m_run_id;
+        run.generation = getLayoutGeneration();
+        layoutRun(run);
+        it = m_layout_cache.find(hash);
+    }
+    it->second.last_frame = m_frame;
+
+    item.run = &it->second;
+    item.run_id = it->second.id;
+    item.x = std::floor(x); // the subpixel variants were picked for a whole pixel origin
+    item.y = std::floor(y);
+    std::memcpy(item.color, style.color, sizeof(float) * 4);
+    m_immediate.push_back(item);
+}
+
+
+void Text2D::layoutRun(struct glyph_run& run){
+    const text_metrics* metrics;
+    float line_x = 0.0f, pen_y = 0.0f;
+
+    // same alignment as the strings (see getPenXY)
+    m_font_atlas->measure(run.text.c_str(), run.scale, &metrics, run.font_style);
+    if(run.alignment == STRING_ALIGN_CENTER_X || run.alignment == STRING_ALIGN_CENTER_XY)
+        line_x -= metrics->width / 2;
+    if(run.alignment == STRING_ALIGN_CENTER_Y || run.alignment == STRING_ALIGN_CENTER_XY)
+        pen_y += (metrics->height / 2) - (getFontHeigth() * run.scale);
+    if(run.alignment == STRING_ALIGN_LEFT)
+        line_x -= metrics->width;
+
+    run.vertices.resize(8 * (metrics->advances.size() - (metrics->lines - 1)));
+    run.tex_coords.resize(run.vertices.size());
+    bidi_reorder(run.text.c_str(), m_run_order); // the layout is cached, so is its order
+    layoutLines(run.text.c_str(), m_run_order.empty() ? nullptr : m_run_order.data(),
+                run.scale, run.font_style, metrics->width, line_x, pen_y, run.vertices.data(),
+                run.tex_coords.data(), nullptr);
+}
+
+
+void Text2D::updateImmediate(){
+    uint glyphs = 0, index = 0;
+    bool unchanged;
+
+    for(uint i=0; i < m_immediate.size(); i++)
+        glyphs += m_immediate[i].run->vertices.size() / 8;
+    if(glyphs > m_immediate_capacity){
+        m_immediate_capacity = std::max(glyphs, m_immediate_capacity * 2);
+        updateBuffers(); // also clears m_last_immediate
+    }
+
+    // same runs at the same positions and with the same colors, the buffers are up to date
+    unchanged = m_immediate.size() == m_last_immediate.size();
+    for(uint i=0; unchanged && i < m_immediate.size(); i++){
+        const struct immediate_text& a = m_immediate[i], &b = m_last_immediate[i];
+        unchanged = a.run_id == b.run_id && a.x == b.x && a.y == b.y &&
+                    !std::memcmp(a.color, b.color, sizeof(float) * 4);
+    }
+
+    if(!unchanged && glyphs){
+        m_immediate_vertices.resize(8 * glyphs); // these never shrink
+        m_immediate_tex.resize(8 * glyphs);
+        m_immediate_col.resize(16 * glyphs);
+        for(uint i=0; i < m_immediate.size(); i++){
+            const struct immediate_text& item = m_immediate[i];
+            const std::vector<float>& vertices = item.run->vertices;
+
+            for(uint j=0; j < vertices.size(); j += 2){
+                m_immediate_vertices[index * 8 + j] = vertices[j] + item.x;
+                m_immediate_vertices[index * 8 + j + 1] = vertices[j + 1] + item.y;
+            }
+            std::copy(item.run->tex_coords.begin(), item.run->tex_coords.end(),
+                      m_immediate_tex.begin() + index * 8);
+            for(uint j=0; j < vertices.size() / 2; j++)
+                std::memcpy(&m_immediate_col[index * 16 + j * 4], item.color, sizeof(float) * 4);
+            index += vertices.size() / 8;
+        }
+
+        m_backend->updateGeometry(m_num_indices / 6, m_immediate_vertices.data(),
+                                  m_immediate_tex.data(), m_immediate_col.data(), glyphs);
+#ifdef PTT_PROFILE
+        m_stats.bytes_uploaded += 32 * glyphs * sizeof(float);
+        m_stats.total_bytes_uploaded += 32 * glyphs * sizeof(float);
+#endif // PTT_PROFILE
+    }
+    m_immediate_glyphs = glyphs;
+
+    m_immediate.swap(m_last_immediate);
+    m_immediate.clear();
+
+    if(m_layout_cache.size() > LAYOUT_CACHE_MAX){
+        std::unordered_map<size_t, struct glyph_run>::iterator it = m_layout_cache.begin();
+        while(it != m_layout_cache.end()){
+            if(it->second.last_frame != m_frame)
+                it = m_layout_cache.erase(it);
+            else
+                ++it;
+        }
+    }
+    m_frame++;
+}
+
+
 void Text2D::clearStrings(){
+    std::lock_guard<std::mutex> lock(m_batch_mutex);
+
+    m_pending.clear();
     m_strings.clear();
+    m_interned.clear();
+    m_interned_sweep = INTERNED_SWEEP_MIN;
+    m_next_id = 0;
+    m_effects.clear();
+    m_update_effects = true;
     m_update_buffer = true;
 }
 
 
+void Text2D::reserve(uint num_strings, uint num_glyphs){
+    m_strings.reserve(num_strings);
+    m_spare_layouts.reserve(SPARE_LAYOUTS_MAX);
+    m_cull_stamp.reserve(num_strings);
+    m_visible.reserve(num_strings);
+    m_ranges.reserve(num_strings + 1); // and the immediate mode glyphs
+    if(m_buffer_vertices.size() < 8 * num_glyphs){
+        m_buffer_vertices.resize(8 * num_glyphs);
+        m_buffer_tex.resize(8 * num_glyphs);
+        m_buffer_col.resize(16 * num_glyphs);
+    }
+    if(m_hit_testing){
+        m_string_lines.reserve(num_strings);
+        m_lines.reserve(num_strings);
+        m_glyph_x.reserve(num_glyphs + num_strings);
+    }
+}
+
+
+void Text2D::submit(TextBatch& batch){
+    std::lock_guard<std::mutex> lock(m_batch_mutex);
+
+    if(m_pending.empty()){
+        m_pending.swap(batch.m_commands);
+    }
+    else{
+        m_pending.insert(m_pending.end(), std::make_move_iterator(batch.m_commands.begin()),
+                         std::make_move_iterator(batch.m_commands.end()));
+    }
+    batch.m_commands.clear();
+}
+
+
+void Text2D::setBlob(const TextBlob* blob){
+    m_blob = blob;
+    m_update_buffer = true;
+}
+
+
+void Text2D::mergeBatches(){
+    {
+        std::lock_guard<std::mutex> lock(m_batch_mutex);
+        if(m_pending.empty())
+            return;
+        m_merging.swap(m_pending);
+    }
+
+    for(uint i=0; i < m_merging.size(); i++){
+        struct text_command& command = m_merging[i];
+
+        if(command.type == TEXT_COMMAND_ADD){
+            if(m_strings.size() <= command.id)
+                m_strings.resize(command.id + 1);
+            m_strings[command.id] = std::move(command.str);
+            internLayout(m_strings[command.id]);
+        }
+        else if(command.id < m_strings.size()){ // dropped if the add wasn't submitted yet
+            struct string& str = m_strings[command.id];
+            if(command.type == TEXT_COMMAND_REMOVE){
+                removeString(command.id);
+                continue;
+            }
+            str.posx = command.str.posx;
+            str.posy = command.str.posy;
+            str.scale = command.str.scale;
+            str.font_style = command.str.font_style;
+            str.strlen = command.str.strlen;
+            str.width = command.str.width;
+            str.height = command.str.height;
+            releaseLayout(str);
+            str.layout.swap(command.str.layout);
+            internLayout(str);
+        }
+    }
+    m_merging.clear();
+    m_update_buffer = true;
+}
+
+
+TextBatch::TextBatch(Text2D* text){
+#ifdef DEBUG
+    assert(text);
+#endif // DEBUG
+    m_text = text;
+}
+
+
+struct string& TextBatch::record(int type, uint id){
+    m_commands.push_back(text_command());
+    m_commands.back().type = type;
+    m_commands.back().id = id;
+    return m_commands.back().str;
+}
+
+
+uint TextBatch::addString(const wchar_t* text, uint x, uint y, float scale, int placement,
+                          int alignment, float color[4], const struct string_span* spans,
+                          uint num_spans){
+#ifdef DEBUG
+    assert(color);
+    assert(text);
+    assert(alignment > 0);
+    assert(alignment < 6);
+#endif // DEBUG
+    uint id = m_text->m_next_id++;
+    struct string& str = record(TEXT_COMMAND_ADD, id);
+
+    initString(str, x, y, scale, placement, alignment, color);
+    setSpans(str, spans, num_spans);
+    m_text->setText(str, text, false);
+    m_text->layoutString(*str.layout);
+
+    return id;
+}
+
+
+uint TextBatch::addString(const wchar_t* text, float relative_x, float relative_y,
+                          float scale, int alignment, float color[4],
+                          const struct string_span* spans, uint num_spans){
+#ifdef DEBUG
+    assert(relative_x >= 0.0);
+    assert(relative_x <= 1.0);
+    assert(relative_y >= 0.0);
+    assert(relative_y <= 1.0);
+#endif // DEBUG
+    uint id = addString(text, 0, 0, scale, STRING_DRAW_RELATIVE, alignment, color, spans,
+                        num_spans);
+
+    struct string& str = m_commands.back().str;
+    str.relative_x = relative_x;
+    str.relative_y = relative_y;
+
+    return id;
+}
+
+
+void TextBatch::updateString(uint index, const wchar_t* text, uint x, uint y, float scale,
+                             uint font_style){
+#ifdef DEBUG
+    assert(text);
+#endif // DEBUG
+    struct string& str = record(TEXT_COMMAND_UPDATE, index);
+
+    str.posx = x;
+    str.posy = y;
+    str.scale = scale;
+    str.font_style = font_style;
+    m_text->setText(str, text, false);
+    m_text->layoutString(*str.layout);
+}
+
+
+void TextBatch::removeString(uint index){
+    record(TEXT_COMMAND_REMOVE, index);
+}
+
+
+uint TextBatch::size() const{
+    return m_commands.size();
+}
+
+
 void Text2D::onFramebufferSizeUpdate(int fb_width, int fb_height){
+    // follow the framebuffer unless the cull rectangle was changed by the user
+    if(m_cull_rect[0] == 0.0f && m_cull_rect[1] == 0.0f && 
+       m_cull_rect[2] == m_fb_width && m_cull_rect[3] == m_fb_height){
+        m_cull_rect[2] = fb_width;
+        m_cull_rect[3] = fb_height;
+    }
     m_fb_width = fb_width;
     m_fb_height = fb_height;
     m_update_buffer = true;
@@ -333,11 +1560,40 @@ void Text2D::onFramebufferSizeUpdate(int fb_width, int fb_height){
 
 
 void Text2D::setDisplacement(float x, float y){
+    if(m_disp[0] != x || m_disp[1] != y)
+        m_update_cull = true;
     m_disp[0] = x;
     m_disp[1] = y;
 }
 
 
+void Text2D::setOutlineScale(float scale){
+    m_outline_scale = scale;
+    m_layout_serial++; // lays out everything again
+    m_update_buffer = true;
+}
+
+
+uint Text2D::getLayoutGeneration() const{
+    return m_font_atlas->getGeneration() + m_layout_serial;
+}
+
+
+void Text2D::setCulling(bool culling){
+    m_culling = culling;
+    m_update_cull = true;
+}
+
+
+void Text2D::setCullRect(float x, float y, float width, float height){
+    m_cull_rect[0] = x;
+    m_cull_rect[1] = y;
+    m_cull_rect[2] = width;
+    m_cull_rect[3] = height;
+    m_update_cull = true;
+}
+
+
 uint Text2D::getFontHeigth() const{
     return m_font_atlas->getHeight() >> 6;
 }
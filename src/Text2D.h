@@ -17,11 +17,31 @@
 #ifndef TEXT2D_HPP
 #define TEXT2D_HPP
 
-#include <GLFW/glfw3.h>
+#ifdef PTT_NO_GL
+typedef unsigned int GLuint;
+#else
+    #include <GLFW/glfw3.h>
+#endif // PTT_NO_GL
 
 #include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#ifdef PTT_PROFILE
+    #include <fstream>
+    #include <chrono>
+#endif // PTT_PROFILE
+
+#include "RenderBackend.h"
 
 class FontAtlas;
+class TextBatch;
+class TextBlob;
+struct character;
+struct glyph_outline;
 
 
 #define STRING_MAX_LEN 256
@@ -40,34 +60,307 @@ class FontAtlas;
 #define STRING_ALIGN_CENTER_XY 4
 #define STRING_ALIGN_RIGHT 5 // this should be used when the text is drawn relative to the bottom left/top right
 
+// height in pixels of the horizontal bands used to cull strings outside of the view
+#define CULL_BAND_HEIGHT 128
+
+// default scale from which the glyphs with an outline are drawn from it (see setOutlineScale)
+#define OUTLINE_MIN_SCALE 1.5f
+
+/* Atlas glyphs of strings with an effect have EFFECT_TEX_STRIDE times its index in the effect
+ * table (starting at 1) added to their v texture coordinate, see setStringEffect */
+#define EFFECT_TEX_STRIDE 2.0f
+#define TEXT_MAX_EFFECTS 16
+
+// immediate mode layouts kept by each Text2D, the ones not drawn in the last frame are dropped
+#define LAYOUT_CACHE_MAX 1024
+
+// layouts of removed or updated strings kept for the next ones (see Text2D::updateString)
+#define SPARE_LAYOUTS_MAX 256
+// the layouts without strings leave the table when it doubles its size, but not below this
+#define INTERNED_SWEEP_MIN 1024
+
+// commands recorded by a TextBatch
+#define TEXT_COMMAND_ADD 1
+#define TEXT_COMMAND_UPDATE 2
+#define TEXT_COMMAND_REMOVE 3
+
+// glyph_line::first_order of the lines in logical order
+#define TEXT_LINE_NOT_REORDERED 0xffffffff
+
+// per frame stats dump formats (see setStatsDump)
+#define STATS_DUMP_CSV 1
+#define STATS_DUMP_TRACE 2 // chrome://tracing or perfetto
+
+
+/* Filled only when built with PTT_PROFILE (make PROFILE=1), everything is zero otherwise.
+ * The timers are in milliseconds, the "last" ones refer to the latest rebuild. */
+struct text_stats{
+    uint frames;
+    uint rebuilds;
+    uint glyphs; // glyphs in the buffers
+    uint drawn_glyphs; // glyphs drawn in the last frame, after culling
+    size_t bytes_uploaded; // in the last frame
+    size_t total_bytes_uploaded;
+    double layout_ms; // last rebuild, CPU
+    double upload_ms; // last rebuild, CPU side of glBufferData
+    double draw_ms; // latest available draw time (see RenderBackend::getDrawTime)
+    size_t allocations; // heap allocations of the last render, needs PTT_ALLOC_COUNTER
+};
+
+
+/* Drawn by the fragment shader from the same quad as the glyph, needs a distance field atlas
+ * (see FontAtlas::setSdfRendering). Distances are in pixels, and the outline width plus the
+ * shadow offset and softness should stay within ATLAS_SDF_SPREAD times the string scale. */
+struct text_effect{
+    float outline_width; // 0 for none
+    float outline_color[4];
+    float shadow_offset[2]; // x right, y up
+    float shadow_softness; // a glow is a soft shadow without offset
+    float shadow_color[4]; // alpha 0 for none
+};
+
+
+// attributes of the immediate mode text (see drawText)
+struct text_style{
+    float scale;
+    int alignment;
+    float color[4];
+    uint font_style; // see FontAtlas::addStyle, 0 for the font as loaded
+};
+
+
+struct text_rect{
+    float x;
+    float y;
+    float width;
+    float height;
+};
+
 
 class Text2D{
+    friend class TextBatch;
+    friend class TextBlob;
     private:
-        GLuint m_vao, m_vbo_vert, m_vbo_tex, m_vbo_col, m_vbo_ind;
-        GLuint m_disp_location;
-        GLuint m_num_vertices, m_num_indices;
+        RenderBackend* m_backend;
+        bool m_owns_backend;
+        uint m_num_vertices, m_num_indices;
         std::vector<struct string> m_strings;
         bool m_update_buffer, m_init;
         int m_fb_width, m_fb_height;
-        GLuint m_shader;
         float m_disp[2];
 
         const FontAtlas* m_font_atlas;
+        float m_outline_scale;
+        uint m_layout_serial; // changes with the layout options
+
+        // culling
+        bool m_culling, m_update_cull;
+        float m_cull_rect[4]; // x, y, width, height
+        float m_bands_origin;
+        uint m_cull_frame;
+        std::vector<std::vector<uint>> m_cull_bands; // string indices that overlap each band
+        uint m_num_cull_bands; // in use, the bands never shrink to keep their memory
+        std::vector<uint> m_cull_stamp; // last frame in which each string was visited
+        std::vector<uint> m_visible;
+        std::vector<struct quad_range> m_ranges; // drawn glyphs
+
+        // hit testing
+        struct glyph_line{
+            uint string;
+            uint first_offset; // offset in the string of the first character
+            uint first_x; // position in m_glyph_x
+            uint first_order; // position in m_glyph_order, TEXT_LINE_NOT_REORDERED if none
+            uint count;
+            float y_min;
+            float y_max;
+        };
+        bool m_hit_testing;
+        std::vector<struct glyph_line> m_lines;
+        std::vector<float> m_glyph_x; // pen x before every character of a line, plus its end
+        // offset in the line of every character of the reordered lines in visual order, m_glyph_x
+        // has their left edges instead (see bidi_reorder)
+        std::vector<uint> m_glyph_order;
+        std::vector<uint> m_string_lines; // first line of each string
+        std::vector<std::vector<uint>> m_line_bands;
+        uint m_num_line_bands;
+        float m_line_bands_origin;
+
+#ifdef PTT_PROFILE
+        struct text_stats m_stats;
+        std::ofstream m_stats_dump;
+        int m_stats_format;
+        bool m_stats_first_event;
+        std::chrono::steady_clock::time_point m_stats_epoch, m_layout_start, m_upload_start;
+
+        void dumpFrameStats(bool rebuilt);
+#endif // PTT_PROFILE
+
+        // immediate mode
+        struct glyph_run{ // quads of a string relative to its origin
+            std::wstring text;
+            float scale;
+            int alignment;
+            uint font_style;
+            std::vector<float> vertices;
+            std::vector<float> tex_coords;
+            uint id; // changes when the entry is reused for another string
+            uint generation; // see getLayoutGeneration
+            uint last_frame;
+        };
+        struct immediate_text{
+            const struct glyph_run* run;
+            uint run_id;
+            float x;
+            float y;
+            float color[4];
+        };
+        std::unordered_map<size_t, struct glyph_run> m_layout_cache;
+        std::vector<struct immediate_text> m_immediate, m_last_immediate; // this and the last frame
+        std::vector<float> m_immediate_vertices, m_immediate_tex, m_immediate_col;
+        std::vector<uint16_t> m_run_order; // see layoutRun
+        uint m_immediate_capacity, m_immediate_glyphs; // glyphs after the strings in the buffers
+        uint m_frame, m_run_id;
+
+        /* Layouts shared by the strings with the same text and scale, by hash (see setText).
+         * The ones no string uses stay until the next sweep, for the values that come back. */
+        std::unordered_map<size_t, std::shared_ptr<struct string_layout>> m_interned;
+        size_t m_interned_sweep; // size of the table that triggers the next sweep
+        // layouts without strings, reused by setText with their memory
+        std::vector<std::shared_ptr<struct string_layout>> m_spare_layouts;
+
+        // glyphs of the strings handed to the backend by updateBuffers, they never shrink
+        std::vector<float> m_buffer_vertices, m_buffer_tex, m_buffer_col;
+
+        std::vector<struct text_effect> m_effects; // shared by the strings with the same effect
+        bool m_update_effects;
+
+        const TextBlob* m_blob;
+        uint m_blob_glyphs; // after the strings in the buffers, 0 if it isn't drawn
+        uint m_atlas_generation; // of the atlas the buffers were built with
+
+        // string ids are reserved by any thread, the batches are merged by render
+        std::atomic<uint> m_next_id;
+        std::mutex m_batch_mutex;
+        std::vector<struct text_command> m_pending, m_merging;
 
         void updateBuffers();
-        void initgl();
+        void mergeBatches();
+        void layoutString(struct string_layout& layout) const;
+        /* Lays out the lines of text in visual order (see bidi_reorder, order can be nullptr)
+         * from the origin. Glyph k of the text, line breaks skipped, goes to vertices[k * 8],
+         * and pen_x (if not nullptr) gets the left edge of every character and the end of
+         * every line. Right to left lines are aligned to width. */
+        void layoutLines(const wchar_t* text, const uint16_t* order, float scale,
+                         uint font_style, float width, float origin_x, float origin_y,
+                         float* vertices, float* tex_coords, float* pen_x) const;
+        // final quads of a laid out string, also sets its bounds
+        void writeString(struct string& str, float origin_x, float origin_y, bool effects,
+                         float* vertices, float* tex_coords, float* colors) const;
+        // layouts made with another one are stale
+        uint getLayoutGeneration() const;
+        /* Measures the text and reorders it, or shares the layout of a string with the same
+         * text, scale and font style. Other threads can't use the caches nor share layouts
+         * (cached false), their strings are interned when merged. */
+        void setText(struct string& str, const wchar_t* text, bool cached);
+        void measureLayout(struct string_layout& layout, bool cached) const;
+        void internLayout(struct string& str);
+        // the layouts without strings leave the table
+        void sweepLayouts();
+        void releaseLayout(struct string& str);
+        // a new layout for setText, or a spare one if cached
+        void newLayout(struct string& str, bool cached);
+        void updateImmediate();
+        void layoutRun(struct glyph_run& run);
+        const character* layoutGlyph(wchar_t code, float& pen_x, float pen_y, float scale,
+                                     uint phases, uint font_style, float* vertices,
+                                     float* tex_coords) const;
+        // shears the quad of an oblique style and moves the pen
+        void advanceGlyph(const character& ch, float& pen_x, float pen_y, float scale,
+                          uint phases, uint font_style, float* vertices) const;
+        void layoutOutline(const struct glyph_outline& outline, float pen_x, float pen_y,
+                           float scale, float* vertices, float* tex_coords) const;
+        void init(int fb_width, int fb_height, const FontAtlas* font);
         void getPenXY(float& pen_x, float& pen_y, struct string* string_);
+        void buildCullBands();
+        void buildLineBands();
+        void beginLine(uint string, uint offset, float pen_y, float scale);
+        const struct glyph_line* findLine(uint string, uint offset);
+        uint visualIndex(const struct glyph_line& line, uint offset) const;
+        void updateVisibleRanges();
     public:
         Text2D();
+#ifndef PTT_NO_GL
+        // draws with OpenGL (see GLBackend)
         Text2D(int fb_width, int fb_height, const FontAtlas* font, GLuint shader);
+#endif // PTT_NO_GL
+        // the backend is not owned and has to outlive the object
+        Text2D(int fb_width, int fb_height, const FontAtlas* font, RenderBackend* backend);
         ~Text2D();
 
-        void addString(const wchar_t* string, uint x, uint y, float scale, 
+        /* The add functions return the index of the new string. Indices are never reused,
+         * removed strings are left empty. */
+        uint addString(const wchar_t* string, uint x, uint y, float scale, 
                        int placement, int alignment, float color[4]);
-        void addString(const wchar_t* string, float relative_x, float 
+        uint addString(const wchar_t* string, float relative_x, float 
                        relative_y, float scale, int alignment, float color[4]);
+        // same as above but the color of each span overrides the color of the string
+        uint addString(const wchar_t* string, uint x, uint y, float scale, int placement,
+                       int alignment, float color[4], const struct string_span* spans,
+                       uint num_spans);
+        uint addString(const wchar_t* string, float relative_x, float relative_y,
+                       float scale, int alignment, float color[4],
+                       const struct string_span* spans, uint num_spans);
+        /* Replaces the text and absolute position of a string, keeps its other attributes.
+         * Once every string has been updated a few times there are no heap allocations
+         * unless a text gets longer than it has ever been, see reserve. */
+        void updateString(uint index, const wchar_t* string, uint x, uint y);
+        void removeString(uint index);
+        /* Outline and shadow of a string, nullptr removes them. At most TEXT_MAX_EFFECTS
+         * different effects until clearStrings. Ignored without a distance field atlas. */
+        void setStringEffect(uint index, const struct text_effect* effect);
+        /* Style of the atlas the string is drawn with (see FontAtlas::addStyle), 0 for the font
+         * as loaded. The text is measured and laid out again. */
+        void setStringStyle(uint index, uint font_style);
         void setDisplacement(float x, float y);
+        // indices start again from 0, the batches not merged yet are dropped
         void clearStrings();
+        // memory for this many strings and glyphs, so the first frames don't allocate as they grow
+        void reserve(uint num_strings, uint num_glyphs);
+        // can be called from any thread, empties the batch (see TextBatch)
+        void submit(TextBatch& batch);
+        /* Static glyphs drawn after the strings, not owned, nullptr removes them. The blob is
+         * skipped while it doesn't match the atlas (see TextBlob::isValid). Not hit tested. */
+        void setBlob(const TextBlob* blob);
+
+        /* Immediate mode, the text is drawn only in the next call to render, after the strings
+         * and within the same draw call. Call it every frame. The layout of each text and style
+         * is cached, and if nothing changed since the last frame nothing is uploaded. x and y
+         * are pixels from the bottom left corner, rounded down. Not culled nor hit tested. */
+        void drawText(float x, float y, const wchar_t* text, const struct text_style& style);
+
+        /* Glyphs drawn at this scale or bigger use their outline when the atlas has one (see
+         * FontAtlas::loadOutlines) instead of the magnified bitmap. INFINITY disables it. */
+        void setOutlineScale(float scale);
+
+        /* When culling is enabled only the strings that intersect the cull rectangle (the
+         * framebuffer by default) are drawn. The displacement is taken into account. */
+        void setCulling(bool culling);
+        void setCullRect(float x, float y, float width, float height);
+
+        /* With hit testing enabled updateBuffers keeps the position of every character, so
+         * these queries don't lay out anything. Coordinates are in screen space (displacement
+         * included), offsets count the line breaks. */
+        void setHitTesting(bool hit_testing);
+        // character under the point, returns false if there's none
+        bool hitTest(float x, float y, uint& string, uint& offset);
+        // zero width rectangle before the character at offset (or after the last one)
+        bool getCaretRect(uint string, uint offset, struct text_rect& rect);
+        bool getCharacterRect(uint string, uint offset, struct text_rect& rect);
+
+        /* Profiling, needs PTT_PROFILE. The dump gets one row (CSV) or a few events (trace)
+         * per rendered frame, returns false if the file can't be opened. */
+        void getStats(struct text_stats& stats) const;
+        bool setStatsDump(const char* path, int format);
 
         uint getFontHeigth() const;
 
@@ -75,7 +368,40 @@ class Text2D{
         void render();
 };
 
+// colored run of characters within a string, offsets count the line breaks
+struct string_span{
+    uint offset;
+    uint length;
+    float color[4];
+};
+
+// text and glyphs of a string relative to its pen origin, shared by the equal strings
+struct string_layout{
+    std::wstring text;
+    float scale;
+    uint strlen; // without the \n
+    uint width;
+    uint height;
+    uint font_style;
+    uint measure_generation; // of the atlas the text was measured with
+    size_t hash; // key in the table of the Text2D
+    std::vector<uint16_t> bidi; // visual order made by setText, empty if it's left to right
+    // made by a TextBatch or by updateBuffers
+    std::vector<float> vertices;
+    std::vector<float> tex_coords;
+    // left edge of every character (line breaks included, at the end of their line), plus the end
+    std::vector<float> pen_x;
+    uint generation; // see Text2D::getLayoutGeneration, 0 if none
+};
+
+// moved around, never copied (see TextBatch and Text2D::mergeBatches)
 struct string{
+    string() = default;
+    string(string&&) = default;
+    string& operator=(string&&) = default;
+    string(const string&) = delete;
+    string& operator=(const string&) = delete;
+
     int posx;
     int posy;
     uint strlen;  // string len without the \n
@@ -86,8 +412,49 @@ struct string{
     float scale;
     uint width;
     uint height;
-    wchar_t textbuffer[STRING_MAX_LEN];
     float color[4];
+    std::vector<struct string_span> spans; // sorted by offset, can be empty
+    uint effect; // index in the effect table plus one, 0 for none
+    uint font_style; // see FontAtlas::addStyle
+    std::shared_ptr<struct string_layout> layout; // nullptr if empty
+    // filled by updateBuffers
+    uint first_glyph;
+    float bounds[4]; // x min, y min, x max, y max
+};
+
+struct text_command{
+    int type;
+    uint id;
+    struct string str;
+};
+
+
+/* Records string changes on any thread, the thread measures the text and lays out the glyphs
+ * itself. Text2D::submit hands the commands over and the next render applies them in order,
+ * only copying the glyphs to the buffers. A batch is used by one thread at a time, and the
+ * atlas must not be rebuilt while batches are recorded. */
+class TextBatch{
+    friend class Text2D;
+    private:
+        Text2D* m_text;
+        std::vector<struct text_command> m_commands;
+
+        struct string& record(int type, uint id);
+    public:
+        TextBatch(Text2D* text);
+
+        // same as in Text2D, the returned index can be used right away by any batch
+        uint addString(const wchar_t* string, uint x, uint y, float scale, int placement,
+                       int alignment, float color[4], const struct string_span* spans = nullptr,
+                       uint num_spans = 0);
+        uint addString(const wchar_t* string, float relative_x, float relative_y,
+                       float scale, int alignment, float color[4],
+                       const struct string_span* spans = nullptr, uint num_spans = 0);
+        // the batch can't read the string, so the scale and font style are given again
+        void updateString(uint index, const wchar_t* string, uint x, uint y, float scale,
+                          uint font_style = 0);
+        void removeString(uint index);
+        uint size() const; // commands not submitted yet
 };
 
 
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#ifdef DEBUG
+    #include <cassert>
+#endif // DEBUG
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "TextBlob.h"
+#include "Text2D.h"
+#include "FontAtlas.h"
+
+
+// floats per glyph: 8 position, 8 texture coordinate and 16 color
+#define BLOB_GLYPH_FLOATS 32
+
+
+TextBlob::TextBlob(){
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+    m_header = nullptr;
+}
+
+
+TextBlob::~TextBlob(){
+    unmap();
+}
+
+
+void TextBlob::unmap(){
+    if(m_mapping)
+        munmap(m_mapping, m_mapping_size);
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+}
+
+
+uint TextBlob::build(Text2D& text){
+    struct blob_file_header header;
+    uint num_glyphs = 0, acc = 0, generation;
+    float* vertices;
+
+    text.mergeBatches();
+    generation = text.getLayoutGeneration();
+    for(uint i=0; i < text.m_strings.size(); i++)
+        num_glyphs += text.m_strings[i].strlen;
+
+    std::memset(&header, 0, sizeof(header)); // no garbage in the padding of the files
+    header.magic = BLOB_FILE_MAGIC;
+    header.version = BLOB_FILE_VERSION;
+    header.fingerprint = text.m_font_atlas->getFingerprint();
+    header.num_glyphs = num_glyphs;
+    header.bounds[0] = header.bounds[1] = INFINITY;
+    header.bounds[2] = header.bounds[3] = -INFINITY;
+
+    unmap();
+    m_buffer.assign(sizeof(header) + num_glyphs * BLOB_GLYPH_FLOATS * sizeof(float), 0);
+    vertices = reinterpret_cast<float*>(&m_buffer[sizeof(header)]);
+
+    for(uint i=0; i < text.m_strings.size(); i++){
+        struct string& str = text.m_strings[i];
+        float origin_x, origin_y;
+
+        if(!str.strlen)
+            continue;
+        if(str.layout->generation != generation){
+            if(str.layout->measure_generation != text.m_font_atlas->getGeneration())
+                text.measureLayout(*str.layout, true);
+            text.layoutString(*str.layout);
+        }
+        str.width = str.layout->width;
+        str.height = str.layout->height;
+        text.getPenXY(origin_x, origin_y, &str);
+        text.writeString(str, origin_x, origin_y, false, &vertices[acc * 8],
+                         &vertices[(num_glyphs + acc) * 8],
+                         &vertices[num_glyphs * 16 + acc * 16]);
+        header.bounds[0] = std::min(header.bounds[0], str.bounds[0]);
+        header.bounds[1] = std::min(header.bounds[1], str.bounds[1]);
+        header.bounds[2] = std::max(header.bounds[2], str.bounds[2]);
+        header.bounds[3] = std::max(header.bounds[3], str.bounds[3]);
+        acc += str.strlen;
+    }
+
+    std::memcpy(m_buffer.data(), &header, sizeof(header));
+    m_header = reinterpret_cast<const struct blob_file_header*>(m_buffer.data());
+    return num_glyphs;
+}
+
+
+uint TextBlob::save(const char* path) const{
+#ifdef DEBUG
+    assert(path);
+#endif // DEBUG
+    std::ofstream file;
+
+    if(!m_header){
+        std::cerr << "TextBlob::save: the blob is empty" << std::endl;
+        return EXIT_FAILURE;
+    }
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if(!file.is_open()){
+        std::cerr << "TextBlob::save: failed to open " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    file.write(reinterpret_cast<const char*>(m_header),
+               sizeof(struct blob_file_header) +
+               m_header->num_glyphs * BLOB_GLYPH_FLOATS * sizeof(float));
+
+    return file.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+uint TextBlob::load(const char* path){
+#ifdef DEBUG
+    assert(path);
+#endif // DEBUG
+    const struct blob_file_header* header;
+    struct stat st;
+    void* data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) || (size_t)st.st_size < sizeof(struct blob_file_header)){
+        if(fd >= 0)
+            close(fd);
+        std::cerr << "TextBlob::load: failed to open " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        std::cerr << "TextBlob::load: failed to map " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    header = static_cast<const struct blob_file_header*>(data);
+    if(header->magic != BLOB_FILE_MAGIC || header->version != BLOB_FILE_VERSION ||
+       (size_t)st.st_size != sizeof(struct blob_file_header) +
+                             (size_t)header->num_glyphs * BLOB_GLYPH_FLOATS * sizeof(float)){
+        std::cerr << "TextBlob::load: " << path << " is not a valid blob file" << std::endl;
+        munmap(data, st.st_size);
+        return EXIT_FAILURE;
+    }
+
+    unmap();
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    m_mapping = data;
+    m_mapping_size = st.st_size;
+    m_header = header;
+
+    return EXIT_SUCCESS;
+}
+
+
+bool TextBlob::isValid(const FontAtlas* atlas) const{
+#ifdef DEBUG
+    assert(atlas);
+#endif // DEBUG
+    return m_header && m_header->num_glyphs && m_header->fingerprint &&
+           m_header->fingerprint == atlas->getFingerprint();
+}
+
+
+uint TextBlob::getGlyphCount() const{
+    return m_header ? m_header->num_glyphs : 0;
+}
+
+
+uint64_t TextBlob::getFingerprint() const{
+    return m_header ? m_header->fingerprint : 0;
+}
+
+
+const float* TextBlob::getBounds() const{
+    return m_header ? m_header->bounds : nullptr;
+}
+
+
+const float* TextBlob::getVertices() const{
+    if(!getGlyphCount())
+        return nullptr;
+    return reinterpret_cast<const float*>(m_header + 1);
+}
+
+
+const float* TextBlob::getTexCoords() const{
+    const float* vertices = getVertices();
+    return vertices ? vertices + m_header->num_glyphs * 8 : nullptr;
+}
+
+
+const float* TextBlob::getColors() const{
+    const float* vertices = getVertices();
+    return vertices ? vertices + m_header->num_glyphs * 16 : nullptr;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef TEXT_BLOB_H
+#define TEXT_BLOB_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <vector>
+
+class Text2D;
+class FontAtlas;
+
+
+// blob files (see TextBlob::save)
+#define BLOB_FILE_MAGIC 0x42545450 // "PTTB"
+#define BLOB_FILE_VERSION 1
+
+/* Followed by the vertices, texture coordinates and colors of the glyphs, in the format of
+ * RenderBackend::setGeometry */
+struct blob_file_header{
+    uint magic;
+    uint version;
+    uint64_t fingerprint; // see FontAtlas::getFingerprint
+    uint num_glyphs;
+    float bounds[4]; // x min, y min, x max, y max
+};
+
+
+/*
+ * Immutable glyphs of static text (menus, labels...), laid out once from the strings of a
+ * Text2D and drawn by any Text2D with Text2D::setBlob without measuring or laying out anything.
+ * Blob files are mapped into memory and handed to the backend as they are. The positions are
+ * final, in framebuffer pixels, so the strings placed from other corners than the bottom left
+ * need a new blob when the framebuffer size changes. The string effects aren't kept.
+ */
+class TextBlob{
+    private:
+        std::vector<char> m_buffer; // built blobs
+        void* m_mapping; // loaded blobs
+        size_t m_mapping_size;
+        const struct blob_file_header* m_header; // points into one of the above
+
+        void unmap();
+    public:
+        TextBlob();
+        ~TextBlob();
+        TextBlob(const TextBlob&) = delete;
+        TextBlob& operator=(const TextBlob&) = delete;
+
+        // copies the glyphs of every string, batches included, returns the number of glyphs
+        uint build(Text2D& text);
+        uint save(const char* path) const;
+        uint load(const char* path);
+        // false if there are no glyphs or they come from another atlas, or another version of it
+        bool isValid(const FontAtlas* atlas) const;
+
+        uint getGlyphCount() const;
+        uint64_t getFingerprint() const;
+        const float* getBounds() const;
+        const float* getVertices() const; // nullptr if empty
+        const float* getTexCoords() const;
+        const float* getColors() const;
+};
+
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#ifdef DEBUG
+    #include <cassert>
+#endif // DEBUG
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+
+#include "TextView.h"
+#include "FontAtlas.h"
+#include "common.h"
+
+
+MappedTextFile::MappedTextFile(){
+    m_data = nullptr;
+    m_size = 0;
+    m_num_lines = 0;
+}
+
+
+MappedTextFile::~MappedTextFile(){
+    close();
+}
+
+
+uint MappedTextFile::open(const char* path){
+#ifdef DEBUG
+    assert(path);
+#endif // DEBUG
+    struct stat st;
+    const char* pos, *end;
+    void* data;
+    int fd;
+
+    close();
+
+    fd = ::open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st)){
+        std::cerr << "MappedTextFile::open: failed to open file " << path << std::endl;
+        if(fd >= 0)
+            ::close(fd);
+        return EXIT_FAILURE;
+    }
+
+    m_line_index.push_back(0);
+    if(!st.st_size){
+        ::close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if(data == MAP_FAILED){
+        std::cerr << "MappedTextFile::open: failed to map file " << path << std::endl;
+        m_line_index.clear();
+        return EXIT_FAILURE;
+    }
+    m_data = static_cast<const char*>(data);
+    m_size = st.st_size;
+
+    // sparse line index, the lines in between are found by scanning from the closest entry
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    pos = m_data;
+    end = m_data + m_size;
+    while((pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos)))){
+        pos++;
+        m_num_lines++;
+        if(!(m_num_lines % LINE_INDEX_STRIDE))
+            m_line_index.push_back(pos - m_data);
+    }
+    if(m_data[m_size - 1] != '\n')
+        m_num_lines++; // last line without line break
+    madvise(data, m_size, MADV_RANDOM);
+
+    return EXIT_SUCCESS;
+}
+
+
+void MappedTextFile::close(){
+    if(m_data)
+        munmap(const_cast<char*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+    m_num_lines = 0;
+    m_line_index.clear();
+}
+
+
+size_t MappedTextFile::getLineCount() const{
+    return m_num_lines;
+}
+
+
+void MappedTextFile::getLine(size_t line, wchar_t* buffer, uint buffer_len) const{
+#ifdef DEBUG
+    assert(buffer);
+    assert(buffer_len);
+#endif // DEBUG
+    const char* pos, *end, *line_end;
+    size_t len;
+
+    buffer[0] = '\0';
+    if(line >= m_num_lines)
+        return;
+
+    pos = m_data + m_line_index[line / LINE_INDEX_STRIDE];
+    end = m_data + m_size;
+    for(size_t i=0; i < line % LINE_INDEX_STRIDE; i++)
+        pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos)) + 1;
+
+    line_end = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    if(!line_end)
+        line_end = end;
+    if(line_end > pos && line_end[-1] == '\r')
+        line_end--;
+
+    // a character takes at most 4 bytes, no need to decode past the end of the buffer
+    len = std::min((size_t)(line_end - pos), (size_t)buffer_len * 4);
+    utf8towstr(buffer, pos, len, buffer_len);
+}
+
+
+TextView::TextView(int fb_width, int fb_height, const FontAtlas* font, GLuint shader,
+                   uint x, uint y, uint width, uint height, float scale, float color[4]) :
+                   m_text(fb_width, fb_height, font, shader){
+#ifdef DEBUG
+    assert(color);
+#endif // DEBUG
+    m_font_atlas = font;
+    m_num_lines = 0;
+    m_x = x;
+    m_y = y;
+    m_width = width;
+    m_height = height;
+    m_scale = scale;
+    std::memcpy(m_color, color, sizeof(float) * 4);
+    m_scroll = 0.0;
+    m_anchor = 0;
+    m_fb_height = fb_height;
+    m_line_buffer.resize(STRING_MAX_LEN);
+    updateLineHeight();
+
+    m_text.setCulling(true);
+    m_text.setCullRect(m_x, m_fb_height - (int)(m_y + m_height), m_width, m_height);
+}
+
+
+TextView::~TextView(){
+}
+
+
+void TextView::updateLineHeight(){
+    uint ring_size;
+
+    m_atlas_generation = m_font_atlas->getGeneration();
+    m_line_height = std::max(1.0f, m_text.getFontHeigth() * m_scale);
+    m_visible_lines = m_height / m_line_height + 2; // partially visible lines at both ends
+
+    // the ring only grows, every slot is filled again
+    ring_size = std::max((size_t)m_visible_lines + 2 * TEXT_VIEW_MARGIN, m_slot_line.size());
+    for(uint i=m_slot_line.size(); i < ring_size; i++)
+        m_text.addString(L"", m_x, m_y, m_scale, STRING_DRAW_ABSOLUTE_TL, 
+                         STRING_ALIGN_RIGHT, m_color);
+    m_slot_line.assign(ring_size, SIZE_MAX);
+}
+
+
+void TextView::setSource(const line_source& source, size_t num_lines){
+    m_source = source;
+    m_num_lines = num_lines;
+    m_slot_line.assign(m_slot_line.size(), SIZE_MAX);
+    updateWindow();
+}
+
+
+void TextView::updateWindow(){
+    size_t first = m_scroll, start, ring = m_slot_line.size();
+    uint slot;
+
+    start = first > TEXT_VIEW_MARGIN ? first - TEXT_VIEW_MARGIN : 0;
+
+    // keep the vertex coordinates small so they don't lose precision deep into the document
+    if(start < m_anchor || start - m_anchor > TEXT_VIEW_REANCHOR){
+        m_anchor = start > TEXT_VIEW_REANCHOR / 2 ? start - TEXT_VIEW_REANCHOR / 2 : 0;
+        m_slot_line.assign(ring, SIZE_MAX);
+    }
+
+    for(size_t line=start; line < start + ring; line++){
+        slot = line % ring;
+        if(m_slot_line[slot] == line)
+            continue;
+        m_slot_line[slot] = line;
+
+        m_line_buffer[0] = '\0';
+        if(line < m_num_lines && m_source)
+            m_source(line, m_line_buffer.data(), m_line_buffer.size());
+        m_text.updateString(slot, m_line_buffer.data(), m_x, 
+                            m_y + (line - m_anchor + 1) * m_line_height);
+    }
+
+    m_text.setDisplacement(0.0f, (m_scroll - m_anchor) * m_line_height);
+}
+
+
+void TextView::setScroll(double line){
+    double max_scroll = m_num_lines > m_visible_lines - 2 ? m_num_lines - m_visible_lines + 2 : 0;
+
+    m_scroll = std::min(std::max(line, 0.0), max_scroll);
+    updateWindow();
+}
+
+
+void TextView::scroll(double lines){
+    setScroll(m_scroll + lines);
+}
+
+
+double TextView::getScroll() const{
+    return m_scroll;
+}
+
+
+size_t TextView::getLineCount() const{
+    return m_num_lines;
+}
+
+
+void TextView::onFramebufferSizeUpdate(int fb_width, int fb_height){
+    m_fb_height = fb_height;
+    m_text.onFramebufferSizeUpdate(fb_width, fb_height);
+    m_text.setCullRect(m_x, m_fb_height - (int)(m_y + m_height), m_width, m_height);
+}
+
+
+void TextView::render(){
+    if(m_atlas_generation != m_font_atlas->getGeneration()){ // other font size
+        updateLineHeight();
+        setScroll(m_scroll);
+    }
+    m_text.render();
+}
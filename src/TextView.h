@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef TEXT_VIEW_H
+#define TEXT_VIEW_H
+
+#include <functional>
+#include <vector>
+
+#include "Text2D.h"
+
+class FontAtlas;
+
+
+// lines kept laid out above and below the visible ones
+#define TEXT_VIEW_MARGIN 16
+// the view is re-anchored when it scrolls this many lines away from its anchor
+#define TEXT_VIEW_REANCHOR 1024
+// one out of every LINE_INDEX_STRIDE line offsets is stored by MappedTextFile
+#define LINE_INDEX_STRIDE 256
+
+
+/* Writes the text of a line into buffer (at most buffer_len characters including the
+ * terminator). */
+typedef std::function<void(size_t line, wchar_t* buffer, uint buffer_len)> line_source;
+
+
+/* Read-only memory mapped UTF-8 text file that can be used as a line source. */
+class MappedTextFile{
+    private:
+        const char* m_data;
+        size_t m_size;
+        size_t m_num_lines;
+        std::vector<size_t> m_line_index; // offset of every LINE_INDEX_STRIDE lines
+    public:
+        MappedTextFile();
+        ~MappedTextFile();
+
+        uint open(const char* path);
+        void close();
+
+        size_t getLineCount() const;
+        void getLine(size_t line, wchar_t* buffer, uint buffer_len) const;
+};
+
+
+/* Scrollable view over a document of any size. Only the visible lines plus a margin are
+ * laid out, they are kept in a ring of strings that is recycled as the view scrolls. */
+class TextView{
+    private:
+        Text2D m_text;
+        const FontAtlas* m_font_atlas;
+        uint m_atlas_generation; // of the atlas the line height comes from
+        line_source m_source;
+        size_t m_num_lines;
+        uint m_x, m_y, m_width, m_height; // view rectangle, from the top left corner
+        uint m_visible_lines, m_line_height;
+        float m_scale;
+        float m_color[4];
+        double m_scroll;
+        size_t m_anchor; // document line placed at the top of the view with no scroll
+        std::vector<size_t> m_slot_line; // line held by each string of the ring
+        std::vector<wchar_t> m_line_buffer;
+        int m_fb_height;
+
+        void updateWindow();
+        void updateLineHeight();
+    public:
+        TextView(int fb_width, int fb_height, const FontAtlas* font, GLuint shader,
+                 uint x, uint y, uint width, uint height, float scale, float color[4]);
+        ~TextView();
+
+        void setSource(const line_source& source, size_t num_lines);
+        void setScroll(double line);
+        void scroll(double lines);
+        double getScroll() const;
+        size_t getLineCount() const;
+
+        void onFramebufferSizeUpdate(int fb_width, int fb_height);
+        void render();
+};
+
+
+#endif
@@ -1,11 +1,91 @@
 #include <cstring>
+#ifdef PTT_ALLOC_COUNTER
+    #include <cstdlib>
+    #include <new>
+#endif // PTT_ALLOC_COUNTER
 
 #include "common.h"
 
+
+#ifdef PTT_ALLOC_COUNTER
+static thread_local unsigned long t_alloc_count = 0;
+
+void* operator new(std::size_t size){
+    void* ptr = std::malloc(size ? size : 1);
+
+    if(!ptr)
+        throw std::bad_alloc();
+    t_alloc_count++;
+    return ptr;
+}
+
+
+void* operator new[](std::size_t size){
+    return operator new(size);
+}
+
+
+void operator delete(void* ptr) noexcept{
+    std::free(ptr);
+}
+
+
+void operator delete[](void* ptr) noexcept{
+    std::free(ptr);
+}
+
+
+unsigned long alloc_count(){
+    return t_alloc_count;
+}
+#endif // PTT_ALLOC_COUNTER
+
+
 void wstrcpy(wchar_t* dest, const wchar_t* source, unsigned int max){
     unsigned int i = 0;
-    while(source[i] != '\0' && i < max)
+    while(source[i] != '\0' && i < max - 1)
         i++;
-    std::memcpy(dest, source, (i + 1) * sizeof(wchar_t));
+    std::memcpy(dest, source, i * sizeof(wchar_t));
+    dest[i] = '\0';
 }
 
+
+
+unsigned int utf8towstr(wchar_t* dest, const char* source, unsigned int len, unsigned int max){
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(source);
+    unsigned int i = 0, n = 0, extra, code;
+
+    while(i < len && n < max - 1){
+        if(src[i] < 0x80){
+            code = src[i];
+            extra = 0;
+        }
+        else if((src[i] & 0xE0) == 0xC0){
+            code = src[i] & 0x1F;
+            extra = 1;
+        }
+        else if((src[i] & 0xF0) == 0xE0){
+            code = src[i] & 0x0F;
+            extra = 2;
+        }
+        else if((src[i] & 0xF8) == 0xF0){
+            code = src[i] & 0x07;
+            extra = 3;
+        }
+        else{
+            code = 0xFFFD; // stray continuation byte
+            extra = 0;
+        }
+        i++;
+
+        for(; extra && i < len && (src[i] & 0xC0) == 0x80; extra--, i++)
+            code = (code << 6) | (src[i] & 0x3F);
+        if(extra)
+            code = 0xFFFD; // truncated sequence
+
+        dest[n++] = code;
+    }
+    dest[n] = '\0';
+
+    return n;
+}
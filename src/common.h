@@ -4,5 +4,12 @@
 #define UNUSED(expr) do { (void)(expr); } while (0)
 
 void wstrcpy(wchar_t* dest, const wchar_t* source, unsigned int max);
+// decodes len bytes of UTF-8, writes at most max - 1 characters plus the terminator
+unsigned int utf8towstr(wchar_t* dest, const char* source, unsigned int len, unsigned int max);
+
+#ifdef PTT_ALLOC_COUNTER
+// heap allocations made so far by the calling thread (operator new is replaced in common.cpp)
+unsigned long alloc_count();
+#endif // PTT_ALLOC_COUNTER
 
 #endif
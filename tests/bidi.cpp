@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "../src/Bidi.h"
+#include "../src/common.h"
+
+
+/*
+ * Visual order of mixed left to right and right to left lines (see bidi_reorder). Like the
+ * examples of UAX #9, the upper case letters of the cases stand for hebrew letters.
+ */
+
+
+struct bidi_case{
+    const char* name;
+    const wchar_t* text; // logical order
+    const wchar_t* visual; // lines from left to right, mirrored
+    const char* directions; // of each line, L or R, - for the empty ones
+};
+
+static const struct bidi_case cases[] = {
+    {"rtl in ltr", L"car is THE CAR in english", L"car is RAC EHT in english", "L"},
+    {"ltr in rtl", L"CAR IS the car", L"the car SI RAC", "R"},
+    {"numbers", L"ABC 123 DEF", L"FED 123 CBA", "R"},
+    {"decimals", L"PRICE 12.50 NOW", L"WON 12.50 ECIRP", "R"},
+    {"arabic numbers", L"\x627\x644\x639 12.5", L"12.5 \x639\x644\x627", "R"},
+    {"brackets", L"AB (CD) EF", L"FE (DC) BA", "R"},
+    {"brackets in ltr", L"abc (DEF) ghi", L"abc (FED) ghi", "L"},
+    {"trailing whitespace", L"abc DEF  ", L"abc FED  ", "L"},
+    {"whitespace before tab", L"xy AB \tCD", L"xy BA \tDC", "L"},
+    {"lines", L"abc\nDEF ghi\n\nJK", L"abc\nghi FED\n\nKJ", "LR-R"},
+};
+
+
+// upper case letters to hebrew and back
+static std::wstring to_hebrew(const wchar_t* text){
+    std::wstring result(text);
+
+    for(uint i=0; i < result.size(); i++)
+        if(result[i] >= L'A' && result[i] <= L'V')
+            result[i] = 0x5d0 + (result[i] - L'A');
+    return result;
+}
+
+
+static wchar_t from_hebrew(wchar_t code){
+    return code >= 0x5d0 && code <= 0x5d0 + (L'V' - L'A') ? L'A' + (code - 0x5d0) : code;
+}
+
+
+static uint test_case(const struct bidi_case& test){
+    std::wstring text = to_hebrew(test.text), visual;
+    std::string directions;
+    std::vector<uint16_t> order;
+    uint start = 0, k = 0;
+
+    if(!bidi_reorder(text.c_str(), order)){
+        std::cerr << test.name << ": nothing reordered" << std::endl;
+        return 1;
+    }
+    // order has the characters of each line, without the line breaks
+    while(start <= text.size()){
+        size_t end = std::min(text.find(L'\n', start), text.size());
+
+        if(start == end)
+            directions += '-';
+        else
+            directions += k < order.size() && order[k] & BIDI_RTL_LINE ? 'R' : 'L';
+        for(uint i=start; i < end && k < order.size(); i++, k++){
+            wchar_t code = text[order[k] & BIDI_OFFSET_MASK];
+            visual += from_hebrew(order[k] & BIDI_RTL ? bidi_mirror(code) : code);
+        }
+        if(end < text.size())
+            visual += L'\n';
+        start = end + 1;
+    }
+
+    if(visual != test.visual || directions != test.directions || k != order.size()){
+        std::wcerr << test.name << L": \"" << visual << L"\" (" << directions.c_str()
+                   << L"), expected \"" << test.visual << L"\" (" << test.directions << L")"
+                   << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+
+int main(){
+    std::vector<uint16_t> order;
+    uint errors = 0;
+
+    for(uint i=0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        errors += test_case(cases[i]);
+    if(bidi_reorder(L"left to right (only) 123", order) || !order.empty()){
+        std::cerr << "ltr: reordered" << std::endl;
+        errors++;
+    }
+
+    if(errors){
+        std::cerr << errors << " bidi errors" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "bidi: ok" << std::endl;
+    return EXIT_SUCCESS;
+}
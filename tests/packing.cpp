@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+
+#include "../src/FontAtlas.h"
+#include "../src/common.h"
+
+
+/*
+ * Bakes atlases with every packing mode and checks that no two glyphs overlap and that all of
+ * them are inside the atlas. Doesn't need a GL context.
+ */
+
+
+struct glyph_rect{
+    uint code;
+    uint style;
+    int x0, y0, x1, y1;
+};
+
+
+static void add_rects(const FontAtlas& atlas, uint start, uint end,
+                      std::vector<struct glyph_rect>& rects){
+    int size = atlas.getAtlasSize();
+    const character* ch;
+
+    for(uint style=0; style < atlas.getStyleCount(); style++){
+        for(uint code=start; code <= end; code++){
+            if(atlas.getCharacter(code, 0, style, &ch) || ch->style != style)
+                continue; // drawn with the normal glyph
+            struct glyph_rect rect = {code, style,
+                                      (int)std::lround(ch->tex_x_min * size),
+                                      (int)std::lround(ch->tex_y_min * size),
+                                      (int)std::lround(ch->tex_x_max * size),
+                                      (int)std::lround(ch->tex_y_max * size)};
+            if(rect.x1 > rect.x0 && rect.y1 > rect.y0) // blank glyphs take no space
+                rects.push_back(rect);
+        }
+    }
+}
+
+
+// returns the number of glyphs overlapping another one or the edges of the atlas
+static uint check_rects(const char* name, int size, const std::vector<struct glyph_rect>& rects){
+    uint errors = 0;
+
+    for(uint i=0; i < rects.size(); i++){
+        const struct glyph_rect& a = rects[i];
+
+        if(a.x0 < 0 || a.y0 < 0 || a.x1 > size || a.y1 > size){
+            std::cerr << name << ": glyph " << a.code << " (style " << a.style
+                      << ") is outside the atlas" << std::endl;
+            errors++;
+        }
+        for(uint j=i+1; j < rects.size(); j++){
+            const struct glyph_rect& b = rects[j];
+
+            // characters with the same glyph share their pixels on purpose
+            if(a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1)
+                continue;
+            if(a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1){
+                std::cerr << name << ": glyphs " << a.code << " (style " << a.style << ") and "
+                          << b.code << " (style " << b.style << ") overlap" << std::endl;
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+
+// corpus, if any, is loaded before the range to weigh the characters of frequency packing
+// embolden adds a bold style, which changes the heights, and a bold oblique that shares it
+static uint test_packing(const char* font, const char* name, int mode,
+                         const wchar_t* corpus = nullptr, float embolden = 0.0f){
+    FontAtlas atlas(1024);
+    std::vector<struct glyph_rect> rects;
+
+    if(atlas.loadFont(font, 32)){
+        std::cerr << name << ": failed to load " << font << std::endl;
+        return 1;
+    }
+    atlas.setPackingMode(mode);
+    if(embolden > 0.0f){
+        struct font_style style = {};
+        style.embolden = embolden;
+        atlas.addStyle(style);
+        style.oblique = 0.2f;
+        atlas.addStyle(style);
+    }
+    if(corpus)
+        atlas.loadCorpus(corpus);
+    atlas.loadCharacterRange(32, 255);
+    if(atlas.createAtlas(false)){
+        std::cerr << name << ": the atlas is full" << std::endl;
+        return 1;
+    }
+    add_rects(atlas, 32, 255, rects);
+
+    return check_rects(name, atlas.getAtlasSize(), rects);
+}
+
+
+// the glyphs that don't fit are left out, the ones baked have to be inside the atlas
+static uint test_full_atlas(const char* font){
+    FontAtlas atlas(128);
+    std::vector<struct glyph_rect> rects;
+
+    if(atlas.loadFont(font, 32)){
+        std::cerr << "full: failed to load " << font << std::endl;
+        return 1;
+    }
+    atlas.setPackingMode(ATLAS_PACK_CODE);
+    atlas.loadCharacterRange(32, 255);
+    if(!atlas.createAtlas(false)){
+        std::cerr << "full: the glyphs can't fit in a 128x128 atlas" << std::endl;
+        return 1;
+    }
+    add_rects(atlas, 32, 255, rects); // the ones left out have no texture coordinates
+
+    return check_rects("full", atlas.getAtlasSize(), rects);
+}
+
+
+int main(int argc, char* argv[]){
+    const char* font = argc > 1 ? argv[1] : "data/Vera.ttf";
+    uint errors = 0;
+
+    errors += test_packing(font, "height", ATLAS_PACK_HEIGHT);
+    errors += test_packing(font, "code", ATLAS_PACK_CODE);
+    // short lowercase letters first, then the taller ones
+    errors += test_packing(font, "frequency", ATLAS_PACK_FREQUENCY,
+                           L"a a a a e e e e o o o s s s x x m m n n . , - _ ~ "
+                           L"Aa 1 Q j g y p \x00c7 \x00c5 \x00de ||| ((( [[[ {{{");
+    errors += test_packing(font, "bold height", ATLAS_PACK_HEIGHT, nullptr, 2.0f);
+    errors += test_packing(font, "bold code", ATLAS_PACK_CODE, nullptr, 2.0f);
+    errors += test_packing(font, "bold frequency", ATLAS_PACK_FREQUENCY, L"aaaa eee oo g j |",
+                           2.0f);
+    errors += test_full_atlas(font);
+
+    if(errors){
+        std::cerr << errors << " packing errors" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "packing: ok" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+
+#include "../src/FontAtlas.h"
+#include "../src/Text2D.h"
+#include "../src/SoftwareBackend.h"
+
+
+/*
+ * Draws upright and oblique strokes with SoftwareBackend and checks that the oblique ones are
+ * slanted, every row as wide as the upright glyph and moved by the shear, not stretched.
+ * Doesn't need a GL context.
+ */
+
+
+#define TEST_WIDTH 256
+#define TEST_HEIGHT 256
+#define TEST_OBLIQUE 0.25f
+
+
+struct stroke_row{
+    int y;
+    int left; // first pixel covered by more than half
+    int width;
+};
+
+
+// rows of the only stroke drawn, bottom to top
+static void read_stroke(const SoftwareBackend& backend, std::vector<struct stroke_row>& rows){
+    const unsigned char* pixels = backend.getPixels();
+
+    rows.clear();
+    for(int y=0; y < TEST_HEIGHT; y++){
+        struct stroke_row row = {y, -1, 0};
+        for(int x=0; x < TEST_WIDTH; x++){
+            if(pixels[(y * TEST_WIDTH + x) * 4] < 128)
+                continue;
+            if(row.left < 0)
+                row.left = x;
+            row.width++;
+        }
+        if(row.width)
+            rows.push_back(row);
+    }
+}
+
+
+static uint test_oblique(FontAtlas& atlas, uint style, const char* name, float scale){
+    float black[4] = {0.f, 0.f, 0.f, 1.f}, white[4] = {1.f, 1.f, 1.f, 1.f};
+    std::vector<struct stroke_row> upright, oblique;
+    SoftwareBackend backend(TEST_WIDTH, TEST_HEIGHT, 1);
+    Text2D text(TEST_WIDTH, TEST_HEIGHT, &atlas, &backend);
+    uint index, errors = 0;
+    float slant;
+
+    index = text.addString(L"l", 40, 40, scale, STRING_DRAW_ABSOLUTE_BL, STRING_ALIGN_RIGHT,
+                           white);
+    backend.clear(black);
+    text.render();
+    read_stroke(backend, upright);
+
+    text.setStringStyle(index, style);
+    backend.clear(black);
+    text.render();
+    read_stroke(backend, oblique);
+
+    if(upright.size() < 10 || oblique.size() != upright.size()){
+        std::cerr << name << ": " << upright.size() << " upright rows and " << oblique.size()
+                  << " oblique rows" << std::endl;
+        return 1;
+    }
+    for(uint i=0; i < upright.size(); i++){
+        if(std::abs(oblique[i].width - upright[i].width) > 1){
+            std::cerr << name << ": row " << upright[i].y << " is " << oblique[i].width
+                      << " pixels wide, " << upright[i].width << " upright" << std::endl;
+            errors++;
+        }
+    }
+    // from the bottom row to the top one the stroke moves by the shear
+    slant = (float)((oblique.back().left - upright.back().left) -
+                    (oblique[0].left - upright[0].left)) / (upright.back().y - upright[0].y);
+    if(std::fabs(slant - TEST_OBLIQUE) > 0.05f){
+        std::cerr << name << ": slant " << slant << " instead of " << TEST_OBLIQUE << std::endl;
+        errors++;
+    }
+    return errors;
+}
+
+
+int main(int argc, char* argv[]){
+    const char* font = argc > 1 ? argv[1] : "data/Vera.ttf";
+    struct font_style style = {};
+    FontAtlas atlas(512);
+    uint errors = 0, oblique;
+
+    if(atlas.loadFont(font, 32)){
+        std::cerr << "failed to load " << font << std::endl;
+        return EXIT_FAILURE;
+    }
+    atlas.loadCharacterRange(32, 126);
+    style.oblique = TEST_OBLIQUE;
+    oblique = atlas.addStyle(style);
+    atlas.createAtlas(false);
+    atlas.loadOutlines();
+
+    errors += test_oblique(atlas, oblique, "atlas", 1.0f);
+    errors += test_oblique(atlas, oblique, "outline", 4.0f); // over the outline scale
+
+    if(errors){
+        std::cerr << errors << " software rendering errors" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "software: ok" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include "../src/FontAtlas.h"
+#include "../src/common.h"
+
+
+/*
+ * Offline atlas compiler, writes atlases that can be loaded with FontAtlas::loadAtlas without
+ * FreeType or a font file. Doesn't need a GL context.
+ */
+
+
+void usage(){
+    std::cerr << "Usage: ptt-bake -f FONT [-f FONT...] -s SIZE [-s SIZE...] -o OUTPUT\n"
+              << "                [-a ATLAS_SIZE] [-r START-END...] [-t TEXT_FILE...]\n"
+              << "                [-p height|code|frequency] [-k] [-d]\n\n"
+              << "  -f FONT        font file, can be repeated\n"
+              << "  -s SIZE        pixel size, can be repeated\n"
+              << "  -o OUTPUT      output file, or prefix when baking more than one atlas\n"
+              << "                 (OUTPUT_FONTNAME_SIZE.ptt)\n"
+              << "  -a ATLAS_SIZE  atlas width and height, power of 2 (default 512)\n"
+              << "  -r START-END   range of code points, can be repeated (default 32-126)\n"
+              << "  -t TEXT_FILE   UTF-8 text, bakes the characters it uses\n"
+              << "  -p MODE        packing mode, height (default), code or frequency\n"
+              << "  -k             include the kerning pairs\n"
+              << "  -d             bake distance fields, for the string effects" << std::endl;
+}
+
+
+std::string output_path(const std::string& output, const std::string& font, int size,
+                        bool single){
+    std::string name = font;
+    size_t pos;
+
+    if(single)
+        return output;
+
+    pos = name.find_last_of('/');
+    if(pos != std::string::npos)
+        name = name.substr(pos + 1);
+    pos = name.find_last_of('.');
+    if(pos != std::string::npos)
+        name = name.substr(0, pos);
+
+    return output + "_" + name + "_" + std::to_string(size) + ".ptt";
+}
+
+
+int main(int argc, char* argv[]){
+    std::vector<std::string> fonts;
+    std::vector<int> sizes;
+    std::vector<std::pair<uint, uint>> ranges;
+    std::vector<std::string> corpus;
+    std::string output;
+    uint atlas_size = 512;
+    int packing_mode = ATLAS_PACK_HEIGHT;
+    bool kerning = false, sdf = false, failed = false;
+
+    for(int i=1; i < argc; i++){
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if(arg == "-k"){
+            kerning = true;
+            continue;
+        }
+        if(arg == "-d"){
+            sdf = true;
+            continue;
+        }
+        if(!value || (arg != "-f" && arg != "-s" && arg != "-o" && arg != "-a" && 
+                      arg != "-r" && arg != "-t" && arg != "-p")){
+            usage();
+            return EXIT_FAILURE;
+        }
+        i++;
+
+        if(arg == "-f"){
+            fonts.push_back(value);
+        }
+        else if(arg == "-s"){
+            sizes.push_back(std::atoi(value));
+            if(sizes.back() <= 0){
+                std::cerr << "Invalid size " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if(arg == "-o"){
+            output = value;
+        }
+        else if(arg == "-a"){
+            atlas_size = std::atoi(value);
+            if(!atlas_size || (atlas_size & (atlas_size - 1))){
+                std::cerr << "The atlas size must be a power of 2" << std::endl;
+                return EXIT_FAILURE;
+            }
+            if(atlas_size > ATLAS_FILE_MAX_SIZE){
+                std::cerr << "The atlas size can't be over " << ATLAS_FILE_MAX_SIZE << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if(arg == "-r"){
+            uint start, end;
+            if(std::sscanf(value, "%u-%u", &start, &end) != 2 || start > end){
+                std::cerr << "Invalid range " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            ranges.push_back(std::make_pair(start, end));
+        }
+        else if(arg == "-t"){
+            std::ifstream file(value);
+            if(!file.is_open()){
+                std::cerr << "Failed to read " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            corpus.push_back(value);
+        }
+        else if(arg == "-p"){
+            if(!std::strcmp(value, "height"))
+                packing_mode = ATLAS_PACK_HEIGHT;
+            else if(!std::strcmp(value, "code"))
+                packing_mode = ATLAS_PACK_CODE;
+            else if(!std::strcmp(value, "frequency"))
+                packing_mode = ATLAS_PACK_FREQUENCY;
+            else{
+                std::cerr << "Unknown packing mode " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if(fonts.empty() || sizes.empty() || output.empty()){
+        usage();
+        return EXIT_FAILURE;
+    }
+    if(ranges.empty() && corpus.empty())
+        ranges.push_back(std::make_pair(32, 126)); // printable ascii
+
+    for(uint i=0; i < fonts.size(); i++){
+        for(uint j=0; j < sizes.size(); j++){
+            FontAtlas atlas(atlas_size);
+            std::string path = output_path(output, fonts[i], sizes[j],
+                                           fonts.size() == 1 && sizes.size() == 1);
+            uint failed_chars = 0;
+
+            if(atlas.loadFont(fonts[i].c_str(), sizes[j])){
+                std::cerr << "Failed to load font " << fonts[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            atlas.setPackingMode(packing_mode);
+            atlas.setSdfRendering(sdf);
+            for(uint k=0; k < ranges.size(); k++)
+                failed_chars += atlas.loadCharacterRange(ranges[k].first, ranges[k].second);
+            for(uint k=0; k < corpus.size(); k++)
+                failed_chars += atlas.loadCorpusFile(corpus[k].c_str());
+
+            if(atlas.createAtlas(false)){
+                std::cerr << path << ": failed to create the complete atlas (out of space?)"
+                          << std::endl;
+                failed = true;
+            }
+            if(kerning)
+                atlas.loadKerning();
+
+            if(atlas.saveAtlas(path.c_str())){
+                std::cerr << "Failed to write " << path << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::cout << path << ": " << atlas.getCharacterCount() << " characters, " 
+                      << atlas.getKerningCount() << " kerning pairs, " << failed_chars
+                      << " characters not in the font" << std::endl;
+
+            if(!corpus.empty()){
+                struct subset_report report;
+                atlas.getSubsetReport(report);
+                std::cout << "    corpus: " << report.glyphs << " glyphs, " << report.bytes
+                          << " bytes (whole unicode pages: " << report.baseline_glyphs
+                          << " glyphs, " << report.baseline_bytes << " bytes, "
+                          << (long)report.baseline_bytes - (long)report.bytes 
+                          << " bytes saved)" << std::endl;
+            }
+        }
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2023 Sergi Garcia Bordils
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the 
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <https://www.gnu.org/licenses/>. 
+ *
+ */
+
+
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include "../src/FontAtlas.h"
+#include "../src/Text2D.h"
+#include "../src/SoftwareBackend.h"
+#include "../src/common.h"
+
+
+/*
+ * Renders a text file into an image on the CPU (see SoftwareBackend), for machines without a
+ * GPU or a display. Doesn't need GL.
+ */
+
+
+#define RENDER_MARGIN 8
+
+
+void usage(){
+    std::cerr << "Usage: ptt-render (-f FONT -s SIZE | -l ATLAS) -o OUTPUT [-w WIDTH]\n"
+              << "                  [-h HEIGHT] [-j THREADS] TEXT_FILE\n\n"
+              << "  -f FONT     font file, bakes the characters used by the text\n"
+              << "  -s SIZE     pixel size\n"
+              << "  -l ATLAS    baked atlas (see ptt-bake) instead of a font\n"
+              << "  -o OUTPUT   PPM image\n"
+              << "  -w WIDTH    image width (default 800)\n"
+              << "  -h HEIGHT   image height (default 600)\n"
+              << "  -j THREADS  rendering threads (default one per core)" << std::endl;
+}
+
+
+int main(int argc, char* argv[]){
+    const char* font = nullptr, *atlas_path = nullptr, *output = nullptr, *text_path = nullptr;
+    int size = 0, width = 800, height = 600, threads = 0;
+
+    for(int i=1; i < argc; i++){
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if(arg[0] != '-' && !text_path){
+            text_path = argv[i];
+            continue;
+        }
+        if(!value){
+            usage();
+            return EXIT_FAILURE;
+        }
+        i++;
+
+        if(arg == "-f")
+            font = value;
+        else if(arg == "-s")
+            size = std::atoi(value);
+        else if(arg == "-l")
+            atlas_path = value;
+        else if(arg == "-o")
+            output = value;
+        else if(arg == "-w")
+            width = std::atoi(value);
+        else if(arg == "-h")
+            height = std::atoi(value);
+        else if(arg == "-j")
+            threads = std::atoi(value);
+        else{
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(!output || !text_path || (!atlas_path && (!font || size <= 0)) || width <= 0 ||
+       height <= 0 || threads < 0){
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream file(text_path);
+    if(!file.is_open()){
+        std::cerr << "Failed to read " << text_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    FontAtlas atlas(1024);
+    if(atlas_path){
+        if(atlas.loadAtlas(atlas_path)){
+            std::cerr << "Failed to load " << atlas_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else{
+        if(atlas.loadFont(font, size)){
+            std::cerr << "Failed to load font " << font << std::endl;
+            return EXIT_FAILURE;
+        }
+        atlas.loadCharacter(32);
+        atlas.loadCorpusFile(text_path);
+        if(atlas.createAtlas(false))
+            std::cerr << "Failed to create the complete atlas (out of space?)" << std::endl;
+    }
+
+    SoftwareBackend backend(width, height, threads);
+    Text2D text(width, height, &atlas, &backend);
+    float background[4] = {1.f, 1.f, 1.f, 1.f}, color[4] = {0.f, 0.f, 0.f, 1.f};
+    wchar_t buffer[STRING_MAX_LEN];
+    std::string line;
+    uint y = RENDER_MARGIN + text.getFontHeigth();
+
+    // one string per line until the image is full
+    while(std::getline(file, line) && y < (uint)height){
+        utf8towstr(buffer, line.c_str(), line.size(), STRING_MAX_LEN);
+        text.addString(buffer, RENDER_MARGIN, y, 1.0f, STRING_DRAW_ABSOLUTE_TL,
+                       STRING_ALIGN_RIGHT, color);
+        y += text.getFontHeigth();
+    }
+
+    backend.clear(background);
+    text.render();
+    std::cout << output << ": " << backend.getPixelsDrawn() << " pixels drawn in "
+              << backend.getDrawTime() << " ms" << std::endl;
+
+    return backend.savePPM(output) ? EXIT_SUCCESS : EXIT_FAILURE;
+}